@@ -2,6 +2,27 @@
  *
  * Build & run:
  *   ./waf --run "scratch/wdm-optical-asymmetric"
+ *   ./waf --run "scratch/wdm-optical-asymmetric --errorMode=closed"   (one draw per packet instead of the per-bit loop)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --benchErrorModel"   (per-bit RNG microbenchmark)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --checkRng"   (RNG known answers and SIMD stream positions)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --stripe=flowlet"     (the same flows bonded over all wavelengths)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --stripe=latency"     (earliest-delivery wavelength per packet;
+ *                                                                    same flows as --stripe=none, compare the
+ *                                                                    "All flows" p99 delay of the two runs)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=ring --roadmNodes=500"   (ROADM build cost)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=mesh --rwaRequests=1000000"   (RWA blocking)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=mesh --rwaRequests=1000000 --flexgrid"
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=mesh --erlangs=2000"   (dynamic lightpath blocking only, no devices or traffic)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=mesh --erlangs=2000 --monteCarlo --lightpathRequests=10000000"
+ *   ./waf --run "scratch/wdm-optical-asymmetric --benchFlexgrid"   (contiguous-slot search at 320/768 slots)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --topology=mesh --erlangs=2000 --qot"   (GN-model SNR per lightpath)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --benchQot"   (incremental vs full QoT updates)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --benchGnNli"   (scalar vs SIMD GN-model NLI kernel)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --spans=20 --wl1.spans=40"   (BER from accumulated EDFA OSNR)
+ *   ./waf --run "scratch/wdm-optical-asymmetric --benchLightpathTag"   (one endpoint decision per lightpath)
+ *
+ * The AVX2 / AVX-512 paths are only compiled in when the compiler targets them, e.g.
+ *   CXXFLAGS="-O3 -march=native" ./waf configure
  */
 
 #include "ns3/core-module.h"
@@ -13,57 +34,4684 @@
 #include "ns3/error-model.h"
 #include "ns3/ipv4-flow-classifier.h"
 
-using namespace ns3;
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ns3;
+
+// ------------------ SNR -> BER (Q-Function Lookup Table) ------------------
+// Modulation formats we can derive a BER for; the SNR is the electrical Es/N0 per polarisation
+enum ModulationFormat
+{
+  OOK,     // On-off keying, direct detection
+  DP_QPSK, // Dual-polarisation QPSK, coherent (2 bits per polarisation)
+  QAM16    // Dual-polarisation 16QAM, coherent, Gray coded
+};
+
+class QFunctionTable
+{ // Q (x) = 0.5 * erfc (x / sqrt (2)) tabulated once, so re-evaluating thousands of wavelengths never calls erfc.
+  // We store ln Q (x): it is almost linear in x, so linear interpolation stays accurate down to BER ~1e-300.
+public:
+  static const QFunctionTable &Get ()
+  {
+    static const QFunctionTable table; // Built on first use (thread-safe since C++11)
+    return table;
+  }
+
+  double Q (double x) const
+  {
+    if (x < 0.0)
+      {
+        return 1.0 - Q (-x); // Q (-x) = 1 - Q (x)
+      }
+    double pos = x * STEPS_PER_UNIT;
+    if (pos >= ENTRIES - 1)
+      {
+        return 0.0; // Q (x > 37) underflows a double anyway
+      }
+    uint32_t i = static_cast<uint32_t> (pos);
+    double frac = pos - i;
+    return std::exp (m_logQ[i] + frac * (m_logQ[i + 1] - m_logQ[i]));
+  }
+
+  // BER of the given format at a linear SNR
+  double Ber (ModulationFormat format, double snr) const
+  {
+    switch (format)
+      {
+      case OOK:
+        return Q (std::sqrt (snr / 2.0));
+      case DP_QPSK:
+        return Q (std::sqrt (snr));
+      case QAM16:
+        return 0.75 * Q (std::sqrt (snr / 5.0));
+      }
+    return 0.0;
+  }
+
+  double BerFromSnrDb (ModulationFormat format, double snrDb) const
+  {
+    return Ber (format, std::pow (10.0, snrDb / 10.0));
+  }
+
+private:
+  static const uint32_t STEPS_PER_UNIT = 64;              // Table resolution in x
+  static const uint32_t ENTRIES = 37 * STEPS_PER_UNIT + 1; // Covers x in [0, 37]
+
+  QFunctionTable ()
+    : m_logQ (ENTRIES)
+  {
+    for (uint32_t i = 0; i < ENTRIES; ++i)
+      {
+        double x = static_cast<double> (i) / STEPS_PER_UNIT;
+        m_logQ[i] = std::log (0.5 * std::erfc (x / std::sqrt (2.0)));
+      }
+  }
+
+  std::vector<double> m_logQ; // ln Q (i / STEPS_PER_UNIT)
+};
+
+// ------------------ Time-Varying BER/SNR Trace ------------------
+class OpticalTrace : public SimpleRefCount<OpticalTrace>
+{ // Replays a measured BER or SNR trace straight from a memory-mapped file, so a 24-hour trace with
+  // millions of samples neither lives on the heap nor needs one scheduled SetBer event per sample.
+  // File format: packed native-endian records { double timeSeconds; double value; }, sorted by time.
+public:
+  enum Kind
+  {
+    BER,   // value is the BER
+    SNR_DB // value is the SNR in dB, mapped to a BER by the error model
+  };
+
+  struct Sample
+  {
+    double timeSeconds;
+    double value;
+  };
+
+  OpticalTrace (const std::string &path, Kind kind)
+    : m_kind (kind),
+      m_fd (-1),
+      m_samples (nullptr),
+      m_count (0),
+      m_mapSize (0),
+      m_cursor (0)
+  {
+    m_fd = open (path.c_str (), O_RDONLY);
+    if (m_fd < 0)
+      {
+        NS_FATAL_ERROR ("Cannot open trace file " << path);
+      }
+    struct stat st;
+    if (fstat (m_fd, &st) != 0 || st.st_size <= 0 || st.st_size % sizeof (Sample) != 0)
+      {
+        NS_FATAL_ERROR ("Trace file " << path << " is empty or not a whole number of (time, value) records");
+      }
+    m_mapSize = static_cast<size_t> (st.st_size);
+    void *map = mmap (nullptr, m_mapSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (map == MAP_FAILED)
+      {
+        NS_FATAL_ERROR ("Cannot map trace file " << path);
+      }
+    madvise (map, m_mapSize, MADV_SEQUENTIAL); // Simulation time only moves forward, so let the kernel read ahead
+    m_samples = static_cast<const Sample *> (map);
+    m_count = m_mapSize / sizeof (Sample);
+  }
+
+  ~OpticalTrace ()
+  {
+    if (m_samples != nullptr)
+      {
+        munmap (const_cast<Sample *> (m_samples), m_mapSize);
+      }
+    if (m_fd >= 0)
+      {
+        close (m_fd);
+      }
+  }
+
+  // Value of the last sample at or before t (the first sample before the trace starts). The cursor
+  // walks forward with simulation time, so this is amortised O(1); a jump backwards falls back to
+  // a binary search.
+  double Lookup (Time t)
+  {
+    double seconds = t.GetSeconds ();
+    if (seconds < m_samples[m_cursor].timeSeconds)
+      {
+        const Sample *it = std::upper_bound (m_samples, m_samples + m_count, seconds,
+                                             [] (double s, const Sample &sample) { return s < sample.timeSeconds; });
+        m_cursor = it == m_samples ? 0 : static_cast<size_t> (it - m_samples) - 1;
+      }
+    while (m_cursor + 1 < m_count && m_samples[m_cursor + 1].timeSeconds <= seconds)
+      {
+        ++m_cursor;
+      }
+    return m_samples[m_cursor].value;
+  }
+
+  Kind GetKind () const { return m_kind; }
+  size_t GetNSamples () const { return m_count; }
+
+private:
+  OpticalTrace (const OpticalTrace &) = delete;
+  OpticalTrace &operator= (const OpticalTrace &) = delete;
+
+  Kind m_kind; // What the values mean
+  int m_fd; // Open trace file
+  const Sample *m_samples; // Mapped records
+  size_t m_count; // Number of records
+  size_t m_mapSize; // Mapped bytes
+  size_t m_cursor; // Index of the sample returned by the last Lookup
+};
+
+// ------------------ Forward Error Correction ------------------
+class FecModel
+{ // Maps the channel (pre-FEC) BER to the BER packets see after decoding. Only closed-form or tabulated
+  // curves are used; nothing is decoded per codeword, and the last mapping is cached.
+public:
+  enum Type
+  {
+    NONE,      // No FEC, packets see the channel BER
+    RS_255_239, // Hard-decision Reed-Solomon RS(255,239), 8-bit symbols, corrects t = 8 symbols (G.975)
+    SD_FEC     // ~20% overhead soft-decision FEC (LDPC class), tabulated waterfall curve
+  };
+
+  FecModel ()
+    : m_type (NONE),
+      m_latency (Seconds (0)),
+      m_lastPreBer (std::numeric_limits<double>::quiet_NaN ()),
+      m_lastPostBer (0.0)
+  {
+  }
+
+  void SetType (Type type)
+  {
+    m_type = type;
+    m_latency = DefaultLatency (type);
+    m_lastPreBer = std::numeric_limits<double>::quiet_NaN ();
+  }
+  void SetLatency (Time latency) { m_latency = latency; }
+
+  Type GetType () const { return m_type; }
+  Time GetLatency () const { return m_latency; } // Decoder latency, added to the link delay by the caller
+
+  static Time DefaultLatency (Type type)
+  { // Order-of-magnitude decoder latencies; override with SetLatency for a specific transponder
+    switch (type)
+      {
+      case RS_255_239:
+        return MicroSeconds (1);
+      case SD_FEC:
+        return MicroSeconds (10);
+      case NONE:
+        break;
+      }
+    return Seconds (0);
+  }
+
+  double PostFecBer (double preBer)
+  {
+    if (m_type == NONE || preBer <= 0.0)
+      {
+        return preBer;
+      }
+    if (preBer == m_lastPreBer)
+      {
+        return m_lastPostBer; // A fixed BER or a steady trace sample; no per-value map, so no heap growth
+      }
+    double postBer = m_type == RS_255_239 ? ReedSolomonPostBer (preBer) : SoftDecisionPostBer (preBer);
+    postBer = std::min (postBer, preBer); // Past the FEC threshold decoding can't make things better
+    m_lastPreBer = preBer;
+    m_lastPostBer = postBer;
+    return postBer;
+  }
+
+private:
+  // Classic bounded-distance decoder estimate: with symbol error probability ps, a codeword carrying
+  // i > t symbol errors is left with ~i errored symbols, so SER_out = sum_{i>t} (i/n) C(n,i) ps^i (1-ps)^(n-i)
+  // and BER_out = SER_out * 2^(m-1) / (2^m - 1). Terms are summed in the log domain to avoid overflow.
+  static double ReedSolomonPostBer (double preBer)
+  {
+    const uint32_t n = 255;
+    const uint32_t t = 8;
+    const uint32_t m = 8;
+    if (preBer >= 0.5)
+      {
+        return preBer;
+      }
+    double logPs = std::log (-std::expm1 (m * std::log1p (-preBer))); // ps = 1 - (1 - ber)^m
+    double log1mPs = m * std::log1p (-preBer);                        // ln (1 - ps)
+    double ser = 0.0;
+    for (uint32_t i = t + 1; i <= n; ++i)
+      {
+        double logTerm = std::lgamma (n + 1.0) - std::lgamma (i + 1.0) - std::lgamma (n - i + 1.0)
+                         + i * logPs + (n - i) * log1mPs;
+        ser += (static_cast<double> (i) / n) * std::exp (logTerm);
+      }
+    return ser * (1u << (m - 1)) / ((1u << m) - 1);
+  }
+
+  // Waterfall of a typical 20% SD-FEC, as (log10 pre-FEC BER, log10 post-FEC BER) points; the
+  // threshold (post-FEC 1e-15) sits at pre-FEC BER 2.7e-2. Below the last point the output is error-free.
+  static double SoftDecisionPostBer (double preBer)
+  {
+    static const double curve[][2] = {
+      {-1.00, -1.00}, {-1.20, -1.35}, {-1.40, -2.20}, {-1.50, -4.00},
+      {-1.55, -8.00}, {-1.57, -15.0}, {-1.60, -20.0}, {-1.70, -30.0}};
+    const uint32_t points = sizeof (curve) / sizeof (curve[0]);
+    double x = std::log10 (preBer);
+    if (x >= curve[0][0])
+      {
+        return preBer; // Far past the threshold, the decoder fails
+      }
+    for (uint32_t i = 1; i < points; ++i)
+      {
+        if (x >= curve[i][0])
+          {
+            double frac = (x - curve[i - 1][0]) / (curve[i][0] - curve[i - 1][0]);
+            return std::pow (10.0, curve[i - 1][1] + frac * (curve[i][1] - curve[i - 1][1]));
+          }
+      }
+    return 0.0;
+  }
+
+  Type m_type; // Code in use
+  Time m_latency; // Decoder latency
+  double m_lastPreBer; // Input of the last mapping (NaN: none yet)
+  double m_lastPostBer; // Its post-FEC BER
+};
+
+// ------------------ RNG Policies ------------------
+// OpticalErrorModelRng<Policy> inlines its draws through one of these. A policy provides:
+//   static const char *Name ();                            -- suffix of the registered TypeId
+//   void BeginPacket (uint64_t streamKey, uint64_t uid);   -- start the draws for one packet
+//   double Uniform ();                                     -- one variate in [0, 1)
+//   void Fill (double *out, uint32_t n);                   -- n variates in [0, 1)
+// streamKey already mixes (RngSeed, RngRun, wavelength id); counter-based policies derive every
+// draw from (streamKey, packet uid), so results don't depend on event order or on other wavelengths.
+
+inline uint64_t SplitMix64 (uint64_t &state)
+{ // Standard SplitMix64 step, used to spread seeds and keys over all 64 bits
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+inline double ToUniform (uint64_t x)
+{ // Top 53 bits -> double in [0, 1)
+  return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+class Mrg32k3aRng
+{ // The ns-3 default: a UniformRandomVariable stream (MRG32k3a, one virtual call per draw). It is a
+  // single sequential stream, so it ignores the packet uid.
+public:
+  static const char *Name () { return "Mrg32k3a"; }
+  Mrg32k3aRng () : m_uniform (CreateObject<UniformRandomVariable> ()) {}
+  void BeginPacket (uint64_t, uint64_t) {}
+  double Uniform () { return m_uniform->GetValue (); }
+  void Fill (double *out, uint32_t n)
+  {
+    for (uint32_t i = 0; i < n; ++i)
+      {
+        out[i] = m_uniform->GetValue ();
+      }
+  }
+
+private:
+  Ptr<UniformRandomVariable> m_uniform;
+};
+
+class PhiloxRng
+{ // Philox4x32-10 (Salmon et al., SC'11): counter-based, key = streamKey, counter = (packet uid, block).
+  // Each block of 10 rounds yields 128 bits, i.e. two doubles.
+public:
+  static const char *Name () { return "Philox4x32"; }
+  PhiloxRng () : m_block (0), m_next (2) { m_key[0] = m_key[1] = 0; m_uid = 0; }
+
+  void BeginPacket (uint64_t streamKey, uint64_t uid)
+  {
+    m_key[0] = static_cast<uint32_t> (streamKey);
+    m_key[1] = static_cast<uint32_t> (streamKey >> 32);
+    m_uid = uid;
+    m_block = 0;
+    m_next = 2; // Nothing buffered
+  }
+
+  double Uniform ()
+  {
+    if (m_next == 2)
+      {
+        Generate (m_buffer);
+        m_next = 0;
+      }
+    return ToUniform (m_buffer[m_next++]);
+  }
+
+  void Fill (double *out, uint32_t n)
+  {
+    uint32_t i = 0;
+    for (; m_next < 2 && i < n; ++i)
+      {
+        out[i] = ToUniform (m_buffer[m_next++]); // Drain what is buffered first
+      }
+    uint64_t block[2];
+    for (; i + 2 <= n; i += 2)
+      {
+        Generate (block);
+        out[i] = ToUniform (block[0]);
+        out[i + 1] = ToUniform (block[1]);
+      }
+    if (i < n)
+      {
+        out[i] = Uniform ();
+      }
+  }
+
+  // The Philox4x32-10 bijection: encrypts counter c in place under key
+  static void Encrypt (uint32_t c[4], const uint32_t key[2])
+  {
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for (int round = 0; round < 10; ++round)
+      {
+        uint64_t p0 = static_cast<uint64_t> (0xD2511F53u) * c[0];
+        uint64_t p1 = static_cast<uint64_t> (0xCD9E8D57u) * c[2];
+        uint32_t n0 = static_cast<uint32_t> (p1 >> 32) ^ c[1] ^ k0;
+        uint32_t n2 = static_cast<uint32_t> (p0 >> 32) ^ c[3] ^ k1;
+        c[0] = n0;
+        c[1] = static_cast<uint32_t> (p1);
+        c[2] = n2;
+        c[3] = static_cast<uint32_t> (p0);
+        k0 += 0x9E3779B9u; // Weyl key schedule
+        k1 += 0xBB67AE85u;
+      }
+  }
+
+private:
+  void Generate (uint64_t out[2])
+  {
+    uint32_t c[4] = {static_cast<uint32_t> (m_uid), static_cast<uint32_t> (m_uid >> 32), m_block++, 0};
+    Encrypt (c, m_key);
+    out[0] = (static_cast<uint64_t> (c[1]) << 32) | c[0];
+    out[1] = (static_cast<uint64_t> (c[3]) << 32) | c[2];
+  }
+
+  uint32_t m_key[2]; // Philox key (the stream)
+  uint64_t m_uid; // Counter high half: packet uid
+  uint32_t m_block; // Counter low half: block within the packet
+  uint64_t m_buffer[2]; // Second half of the last block
+  uint32_t m_next; // Next unused word in m_buffer (2 = empty)
+};
+
+class Xoshiro256ppRng
+{ // xoshiro256++ (Blackman & Vigna), state seeded per packet from SplitMix64 (streamKey ^ uid). Reseeding
+  // costs four SplitMix64 steps, after which every draw is a handful of shifts and adds.
+public:
+  static const char *Name () { return "Xoshiro256pp"; }
+  Xoshiro256ppRng () { m_s[0] = m_s[1] = m_s[2] = m_s[3] = 0; }
+
+  void BeginPacket (uint64_t streamKey, uint64_t uid)
+  {
+    uint64_t seed = streamKey ^ (uid * 0xD1B54A32D192ED03ULL);
+    for (int i = 0; i < 4; ++i)
+      {
+        m_s[i] = SplitMix64 (seed);
+      }
+  }
+
+  uint64_t Next () { return Next (m_s); }
+
+  // One xoshiro256++ step on state s
+  static uint64_t Next (uint64_t s[4])
+  {
+    uint64_t result = Rotl (s[0] + s[3], 23) + s[0];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Rotl (s[3], 45);
+    return result;
+  }
+
+  double Uniform () { return ToUniform (Next ()); }
+
+  void Fill (double *out, uint32_t n)
+  {
+    for (uint32_t i = 0; i < n; ++i)
+      {
+        out[i] = ToUniform (Next ());
+      }
+  }
+
+private:
+  static uint64_t Rotl (uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  uint64_t m_s[4]; // Generator state
+};
+
+class SimdXoshiroRng
+{ // Eight interleaved xoshiro256++ lanes kept in struct-of-arrays form, so one step produces eight
+  // variates with a few vector instructions (AVX-512: one register per state word, AVX2: two, else a
+  // scalar loop the compiler may still vectorise). Draw k of a packet comes from lane k % 8, step k / 8,
+  // on every code path, so results do not depend on the instruction set.
+public:
+  static const uint32_t LANES = 8;
+
+  static const char *Name () { return "SimdXoshiro256pp"; }
+  SimdXoshiroRng () : m_next (LANES) { BeginPacket (0, 0); }
+
+  void BeginPacket (uint64_t streamKey, uint64_t uid)
+  {
+    uint64_t seed = streamKey ^ (uid * 0xD1B54A32D192ED03ULL);
+    for (uint32_t lane = 0; lane < LANES; ++lane)
+      {
+        for (uint32_t word = 0; word < 4; ++word)
+          {
+            m_s[word][lane] = SplitMix64 (seed);
+          }
+      }
+    m_next = LANES;
+  }
+
+  double Uniform ()
+  {
+    if (m_next == LANES)
+      {
+        Step (m_buffer);
+        m_next = 0;
+      }
+    return ToUniform (m_buffer[m_next++]);
+  }
+
+  void Fill (double *out, uint32_t n)
+  {
+    for (uint32_t i = 0; i < n; ++i)
+      {
+        out[i] = Uniform ();
+      }
+  }
+
+  // Generates up to n variates and returns the index of the first one below p (n if there is none).
+  // u < p is decided on the 53-bit integers, u = k / 2^53 < p <=> k < ceil (p * 2^53), so the block is
+  // generated and compared in one pass without converting to double. Lanes left over from an earlier
+  // Uniform () step are used first, and the lanes after the returned one stay buffered, so the stream
+  // position is the same as if every variate had come from Uniform ().
+  uint32_t FirstBelow (double p, uint32_t n)
+  {
+    if (p <= 0.0)
+      {
+        return n;
+      }
+    uint64_t threshold = p >= 1.0 ? (1ULL << 53) : static_cast<uint64_t> (std::ceil (p * 9007199254740992.0));
+    uint32_t used = 0;
+    while (m_next < LANES && used < n)
+      {
+        if ((m_buffer[m_next++] >> 11) < threshold)
+          {
+            return used;
+          }
+        ++used;
+      }
+    if (used == n)
+      {
+        return n;
+      }
+    uint32_t found = FirstBelowInSteps (threshold, n - used);
+    uint32_t consumed = found == n - used ? found : found + 1; // Draws taken from the whole steps
+    m_next = consumed % LANES == 0 ? LANES : consumed % LANES; // m_buffer holds the last step
+    return used + found;
+  }
+
+private:
+  // Body of FirstBelow over whole steps starting at a step boundary; leaves the last step in m_buffer
+  uint32_t FirstBelowInSteps (uint64_t threshold, uint32_t n)
+  {
+#if defined(__AVX512F__)
+    __m512i s0 = _mm512_loadu_si512 (m_s[0]);
+    __m512i s1 = _mm512_loadu_si512 (m_s[1]);
+    __m512i s2 = _mm512_loadu_si512 (m_s[2]);
+    __m512i s3 = _mm512_loadu_si512 (m_s[3]);
+    __m512i limit = _mm512_set1_epi64 (static_cast<long long> (threshold));
+    __m512i result = _mm512_setzero_si512 ();
+    uint32_t found = n;
+    for (uint32_t base = 0; base < n; base += LANES)
+      {
+        result = _mm512_add_epi64 (_mm512_rol_epi64 (_mm512_add_epi64 (s0, s3), 23), s0);
+        __m512i t = _mm512_slli_epi64 (s1, 17);
+        s2 = _mm512_xor_si512 (s2, s0);
+        s3 = _mm512_xor_si512 (s3, s1);
+        s1 = _mm512_xor_si512 (s1, s2);
+        s0 = _mm512_xor_si512 (s0, s3);
+        s2 = _mm512_xor_si512 (s2, t);
+        s3 = _mm512_rol_epi64 (s3, 45);
+        __mmask8 hit = _mm512_cmplt_epu64_mask (_mm512_srli_epi64 (result, 11), limit);
+        if (hit)
+          {
+            found = std::min (n, base + static_cast<uint32_t> (__builtin_ctz (hit)));
+            break;
+          }
+      }
+    _mm512_storeu_si512 (m_s[0], s0);
+    _mm512_storeu_si512 (m_s[1], s1);
+    _mm512_storeu_si512 (m_s[2], s2);
+    _mm512_storeu_si512 (m_s[3], s3);
+    _mm512_storeu_si512 (m_buffer, result);
+    return found;
+#elif defined(__AVX2__)
+    __m256i s[4][2];
+    for (uint32_t w = 0; w < 4; ++w)
+      {
+        s[w][0] = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (&m_s[w][0]));
+        s[w][1] = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (&m_s[w][4]));
+      }
+    // Signed 64-bit compare is fine: both sides are below 2^54
+    __m256i limit = _mm256_set1_epi64x (static_cast<long long> (threshold));
+    __m256i result[2] = {_mm256_setzero_si256 (), _mm256_setzero_si256 ()};
+    uint32_t found = n;
+    for (uint32_t base = 0; base < n && found == n; base += LANES)
+      {
+        uint32_t hit = 0;
+        for (uint32_t h = 0; h < 2; ++h)
+          {
+            __m256i sum = _mm256_add_epi64 (s[0][h], s[3][h]);
+            __m256i rot = _mm256_or_si256 (_mm256_slli_epi64 (sum, 23), _mm256_srli_epi64 (sum, 41));
+            result[h] = _mm256_add_epi64 (rot, s[0][h]);
+            __m256i t = _mm256_slli_epi64 (s[1][h], 17);
+            s[2][h] = _mm256_xor_si256 (s[2][h], s[0][h]);
+            s[3][h] = _mm256_xor_si256 (s[3][h], s[1][h]);
+            s[1][h] = _mm256_xor_si256 (s[1][h], s[2][h]);
+            s[0][h] = _mm256_xor_si256 (s[0][h], s[3][h]);
+            s[2][h] = _mm256_xor_si256 (s[2][h], t);
+            s[3][h] = _mm256_or_si256 (_mm256_slli_epi64 (s[3][h], 45), _mm256_srli_epi64 (s[3][h], 19));
+            __m256i below = _mm256_cmpgt_epi64 (limit, _mm256_srli_epi64 (result[h], 11));
+            hit |= static_cast<uint32_t> (_mm256_movemask_pd (_mm256_castsi256_pd (below))) << (4 * h);
+          }
+        if (hit)
+          {
+            found = std::min (n, base + static_cast<uint32_t> (__builtin_ctz (hit)));
+          }
+      }
+    for (uint32_t w = 0; w < 4; ++w)
+      {
+        _mm256_storeu_si256 (reinterpret_cast<__m256i *> (&m_s[w][0]), s[w][0]);
+        _mm256_storeu_si256 (reinterpret_cast<__m256i *> (&m_s[w][4]), s[w][1]);
+      }
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (&m_buffer[0]), result[0]);
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (&m_buffer[4]), result[1]);
+    return found;
+#else
+    for (uint32_t base = 0; base < n; base += LANES)
+      {
+        Step (m_buffer);
+        uint32_t hit = 0;
+        for (uint32_t lane = 0; lane < LANES; ++lane)
+          {
+            hit |= static_cast<uint32_t> ((m_buffer[lane] >> 11) < threshold) << lane;
+          }
+        if (hit)
+          {
+            return std::min (n, base + static_cast<uint32_t> (__builtin_ctz (hit)));
+          }
+      }
+    return n;
+#endif
+  }
+
+  // One xoshiro256++ step on all lanes (scalar form of the vector loops above)
+  void Step (uint64_t out[LANES])
+  {
+    for (uint32_t lane = 0; lane < LANES; ++lane)
+      {
+        uint64_t sum = m_s[0][lane] + m_s[3][lane];
+        out[lane] = ((sum << 23) | (sum >> 41)) + m_s[0][lane];
+        uint64_t t = m_s[1][lane] << 17;
+        m_s[2][lane] ^= m_s[0][lane];
+        m_s[3][lane] ^= m_s[1][lane];
+        m_s[1][lane] ^= m_s[2][lane];
+        m_s[0][lane] ^= m_s[3][lane];
+        m_s[2][lane] ^= t;
+        m_s[3][lane] = (m_s[3][lane] << 45) | (m_s[3][lane] >> 19);
+      }
+  }
+
+  // Plain arrays with unaligned vector loads: the model lives in a heap-allocated Object, and C++11
+  // new does not honour over-alignment
+  uint64_t m_s[4][LANES]; // State word w of lane l at m_s[w][l]
+  uint64_t m_buffer[LANES]; // Last step, for Uniform ()
+  uint32_t m_next; // Next unused entry of m_buffer (LANES = empty)
+};
+
+// Index of the first of 'bits' bits in error (bits if none): fills a block of variates and compares it
+// against the BER in one pass. SimdXoshiroRng overloads it with its fused vector kernel, Mrg32k3aRng
+// with a draw-at-a-time loop.
+template <class Rng>
+inline uint32_t FirstErrorBit (Rng &rng, double ber, uint32_t bits)
+{
+  const uint32_t BLOCK = 256;
+  double block[BLOCK];
+  for (uint32_t base = 0; base < bits; base += BLOCK)
+    {
+      uint32_t n = std::min (BLOCK, bits - base);
+      rng.Fill (block, n);
+      for (uint32_t i = 0; i < n; ++i)
+        {
+          if (block[i] < ber)
+            {
+              return base + i;
+            }
+        }
+    }
+  return bits;
+}
+
+inline uint32_t FirstErrorBit (SimdXoshiroRng &rng, double ber, uint32_t bits)
+{
+  return rng.FirstBelow (ber, bits);
+}
+
+// The ns-3 stream is sequential and its position is part of what a run reproduces, so MRG32k3a keeps
+// the original draw-at-a-time loop: no variates are drawn past the first errored bit.
+inline uint32_t FirstErrorBit (Mrg32k3aRng &rng, double ber, uint32_t bits)
+{
+  for (uint32_t i = 0; i < bits; ++i)
+    {
+      if (rng.Uniform () < ber)
+        {
+          return i;
+        }
+    }
+  return bits;
+}
+
+// ------------------ Custom Error Model ------------------
+class OpticalImpairmentTag : public Tag
+{ // Noise picked up so far on a transparent lightpath: the sum of the hops' noise-to-signal ratios (ASE and
+  // NLI variances add along the path), added by every TRANSIT error model and read once at the O-E-O endpoint
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("OpticalImpairmentTag")
+      .SetParent<Tag> ()
+      .SetGroupName("Network")
+      .AddConstructor<OpticalImpairmentTag> ();
+    return tid;
+  }
+  virtual TypeId GetInstanceTypeId (void) const override { return GetTypeId (); }
+  virtual uint32_t GetSerializedSize (void) const override { return 5; }
+  virtual void Serialize (TagBuffer i) const override
+  {
+    uint32_t bits; // TagBuffer has no float writer, so the float goes as its bit pattern
+    std::memcpy (&bits, &m_noiseToSignal, sizeof (bits));
+    i.WriteU32 (bits);
+    i.WriteU8 (m_hops);
+  }
+  virtual void Deserialize (TagBuffer i) override
+  {
+    uint32_t bits = i.ReadU32 ();
+    std::memcpy (&m_noiseToSignal, &bits, sizeof (bits));
+    m_hops = i.ReadU8 ();
+  }
+  virtual void Print (std::ostream &os) const override { os << "nsr=" << m_noiseToSignal << " hops=" << +m_hops; }
+
+  OpticalImpairmentTag () : m_noiseToSignal (0.0f), m_hops (0) {}
+
+  void AddHop (double noiseToSignal)
+  {
+    m_noiseToSignal += static_cast<float> (noiseToSignal);
+    m_hops = m_hops < 255 ? m_hops + 1 : 255;
+  }
+  double GetNoiseToSignal () const { return m_noiseToSignal; } // Linear, 1 / accumulated SNR
+  double GetSnrDb () const { return -10.0 * std::log10 (m_noiseToSignal); } // End-to-end SNR so far
+  uint8_t GetHops () const { return m_hops; } // Saturates at 255
+
+private:
+  float m_noiseToSignal; // Accumulated N / S in the signal bandwidth (7 significant digits is plenty)
+  uint8_t m_hops; // Transit hops that added to it
+};
+
+class OpticalErrorModel : public ErrorModel
+{ // This part simulates error characteristics such as packet corruption that happens during transmission-
+  // based on BER (the probability of a bit being corrupted), and SNR (used to access the quality of the signal)
+public:
+  static TypeId GetTypeId (void)
+  { // Register the class as an NS-3 type system; it allows the class to be instantiated within NS-3
+    static TypeId tid = TypeId ("OpticalErrorModel")
+      .SetParent<ErrorModel> ()
+      .SetGroupName("Network")
+      .AddConstructor<OpticalErrorModel> ()
+      // Counters are plain TracedValues: updating one with no sink connected costs a compare
+      .AddTraceSource ("PacketsInspected", "Packets this wavelength's error model has decided on",
+                       MakeTraceSourceAccessor (&OpticalErrorModel::m_packetsInspected),
+                       "ns3::TracedValueCallback::Uint64")
+      .AddTraceSource ("PacketsCorrupted", "Packets this wavelength's error model has corrupted",
+                       MakeTraceSourceAccessor (&OpticalErrorModel::m_packetsCorrupted),
+                       "ns3::TracedValueCallback::Uint64")
+      .AddTraceSource ("BitErrors", "Estimated errored bits in the corrupted packets",
+                       MakeTraceSourceAccessor (&OpticalErrorModel::m_bitErrors),
+                       "ns3::TracedValueCallback::Double");
+    return tid;
+  }
+
+  // Plain snapshot of the trace-source counters, for sweeps that just want the totals
+  struct Counters
+  {
+    uint64_t packetsInspected; // Packets decided on
+    uint64_t packetsCorrupted; // Packets corrupted
+    double bitErrors; // Errored bits: sampled in GEOMETRIC mode, otherwise E[errors | packet corrupted]
+  };
+
+  // Unbiased loss estimate from the importance-sampling likelihood ratios (see SetImportanceSampling)
+  struct LossEstimate
+  {
+    uint64_t packets; // Packets decided in importance-sampling mode
+    double lossRate; // Unbiased estimate of the true packet loss probability
+    double ci95; // Half-width of the 95% confidence interval
+  };
+
+  // How DoCorrupt turns the BER into a corrupt / not-corrupt decision
+  enum CorruptMode
+  {
+    PER_BIT,    // Original approach: one random draw per bit (the default, so existing runs reproduce)
+    CLOSED_FORM, // One draw per packet against PER = 1 - (1 - BER)^bits
+    GEOMETRIC   // Skip ahead between errored bits; also records (and optionally flips) their positions
+  };
+
+  // Where this model sits on a transparent (all-optical) lightpath
+  enum LightpathRole
+  {
+    SINGLE_HOP,  // Decides every packet on its own BER (the default)
+    TRANSIT,     // Adds this hop's noise to the packet's OpticalImpairmentTag; never corrupts, no draw
+    TERMINATION  // O-E-O endpoint: one decision on the tag's accumulated noise plus this hop's own
+  };
+
+  OpticalErrorModel () // This onstructor initializes the error model with the default BER and SNR values
+    : m_ber (1e-8), // Default BER 
+      m_channelBer (1e-8),
+      m_snrDb (30.0), // Default SNR in dB
+      m_mode (PER_BIT), // Same decisions and RNG draws as before; CLOSED_FORM is opt-in
+      m_flipBits (false),
+      m_snrDriven (false),
+      m_modulation (DP_QPSK),
+      m_burst (false),
+      m_burstStarted (false),
+      m_inBadState (false),
+      m_goodBer (1e-8),
+      m_badBer (1e-8),
+      m_goodToBadRate (0.0),
+      m_badToGoodRate (0.0),
+      m_lastTraceValue (std::numeric_limits<double>::quiet_NaN ()),
+      m_role (SINGLE_HOP),
+      m_hopNoiseToSignal (std::pow (10.0, -m_snrDb / 10.0)),
+      m_pathNoiseToSignal (-1.0), // Nothing cached yet
+      m_pathBer (0.0),
+      m_pathLogOneMinusBer (0.0),
+      m_logOneMinusBer (std::log1p (-m_ber)),
+      m_isBias (1.0),
+      m_isPackets (0),
+      m_isWeightSum (0.0),
+      m_isWeightSquareSum (0.0),
+      m_lastWeight (1.0),
+      m_packetsInspected (0),
+      m_packetsCorrupted (0),
+      m_bitErrors (0.0)
+  {
+    PerCacheEntry empty = {std::numeric_limits<double>::quiet_NaN (), 0, 0.0}; // Matches no BER
+    m_perCache.assign (PER_CACHE_SLOTS, empty);
+    SetWavelengthId (0);
+  }
+  // Setters and Getters of the Error Model
+  void SetBer (double ber)
+  {
+    m_channelBer = ber;
+    m_ber = m_fec.PostFecBer (ber); // Packets see the BER left after decoding
+    m_logOneMinusBer = std::log1p (-m_ber); // Shared by the PER formula and the geometric gap sampler
+    m_biasedPerCache.clear ();
+  }
+  // FEC stage between the channel BER (what SetBer, traces and the SNR model produce) and the packets
+  void SetFec (FecModel::Type type)
+  {
+    m_fec.SetType (type);
+    SetBer (m_channelBer);
+  }
+  void SetSnrDb (double snrDb)
+  {
+    m_snrDb = snrDb;
+    m_hopNoiseToSignal = std::pow (10.0, -snrDb / 10.0);
+    if (m_snrDriven)
+      {
+        SetBer (QFunctionTable::Get ().BerFromSnrDb (m_modulation, snrDb)); // Table lookup, no erfc
+      }
+  }
+  // When SNR-driven, every SetSnrDb derives the BER for the given modulation format (SetBer still overrides it)
+  void SetSnrDriven (bool snrDriven, ModulationFormat format)
+  {
+    m_snrDriven = snrDriven;
+    m_modulation = format;
+    if (m_snrDriven)
+      {
+        SetSnrDb (m_snrDb);
+      }
+  }
+  void SetCorruptMode (CorruptMode mode) { m_mode = mode; }
+  // Identifies the wavelength in the per-packet RNG streams of OpticalErrorModelRng
+  void SetWavelengthId (uint32_t id)
+  {
+    m_wavelengthId = id;
+    uint64_t state = (static_cast<uint64_t> (RngSeedManager::GetSeed ()) << 32) ^ RngSeedManager::GetRun ();
+    state = SplitMix64 (state) ^ id;
+    m_streamKey = SplitMix64 (state);
+  }
+  void SetFlipBits (bool flip) { m_flipBits = flip; } // GEOMETRIC mode: really flip the errored bits in the packet
+  // On a transparent lightpath the hops' noise adds up and the errors are decided once, at the endpoint.
+  // Each hop contributes the noise of its SNR (m_snrDb); the TERMINATION model maps the total through
+  // its modulation format and FEC to a BER and makes a single closed-form draw. Burst and importance
+  // sampling only apply to packets arriving without a tag.
+  void SetLightpathRole (LightpathRole role) { m_role = role; }
+  LightpathRole GetLightpathRole () const { return m_role; }
+
+  double GetBer () const { return m_channelBer; } // Pre-FEC
+  double GetPostFecBer () const { return m_ber; }
+  const FecModel &GetFec () const { return m_fec; }
+  double GetSnrDb () const { return m_snrDb; }
+  uint32_t GetWavelengthId () const { return m_wavelengthId; }
+  // Gilbert-Elliott burst errors: the channel alternates between a good and a bad state, each with its own BER.
+  // Rates are transitions per second (1 / mean sojourn time). The state is only advanced when a packet
+  // arrives, from the time elapsed since the previous one, so idle wavelengths schedule no events.
+  void SetBurstModel (double goodBer, double badBer, double goodToBadRate, double badToGoodRate)
+  {
+    m_burst = true;
+    m_burstStarted = false; // Draw the first state from the stationary distribution
+    m_goodBer = goodBer;
+    m_badBer = badBer;
+    m_goodToBadRate = goodToBadRate;
+    m_badToGoodRate = badToGoodRate;
+  }
+  void DisableBurstModel () { m_burst = false; }
+
+  // Drive the BER (or SNR) from a time-indexed trace; with burst mode on it drives the good-state BER
+  void SetTrace (Ptr<OpticalTrace> trace)
+  {
+    m_trace = trace;
+    m_lastTraceValue = std::numeric_limits<double>::quiet_NaN ();
+  }
+
+  // Importance sampling for rare events: packets are corrupted as if the BER were 'bias' times higher,
+  // and every decision records the likelihood ratio w = p/q (corrupted) or (1-p)/(1-q) (not), with p and
+  // q the true and biased PER. The mean of w * 1[corrupted] is an unbiased estimate of the true loss
+  // probability, so a BER of 1e-12 gives usable statistics from a short run. Decisions use the closed
+  // form whatever the corrupt mode. The packets dropped in the simulation follow the biased rate.
+  void SetImportanceSampling (double bias)
+  {
+    m_isBias = std::max (1.0, bias); // 1 disables it
+    m_biasedPerCache.clear ();
+    m_isPackets = 0;
+    m_isWeightSum = 0.0;
+    m_isWeightSquareSum = 0.0;
+  }
+
+  LossEstimate GetLossEstimate () const
+  {
+    LossEstimate estimate;
+    estimate.packets = m_isPackets;
+    estimate.lossRate = 0.0;
+    estimate.ci95 = 0.0;
+    if (m_isPackets > 0)
+      {
+        double n = static_cast<double> (m_isPackets);
+        estimate.lossRate = m_isWeightSum / n;
+        double variance = std::max (0.0, m_isWeightSquareSum / n - estimate.lossRate * estimate.lossRate);
+        estimate.ci95 = 1.96 * std::sqrt (variance / n);
+      }
+    return estimate;
+  }
+
+  Counters GetCounters () const
+  {
+    Counters counters;
+    counters.packetsInspected = m_packetsInspected;
+    counters.packetsCorrupted = m_packetsCorrupted;
+    counters.bitErrors = m_bitErrors;
+    return counters;
+  }
+
+  double GetLastLikelihoodRatio () const { return m_lastWeight; } // Weight of the last decision
+
+  CorruptMode GetCorruptMode () const { return m_mode; }
+  bool IsBurstModel () const { return m_burst; }
+  bool IsInBadState () const { return m_inBadState; }
+  bool IsSnrDriven () const { return m_snrDriven; }
+  ModulationFormat GetModulation () const { return m_modulation; }
+
+  // Probability that at least one of the packet's bits is in error. The per-bit loop stops at the
+  // first error, so it corrupts a packet with exactly this probability; we just skip the loop.
+  double GetPacketErrorRate (uint32_t bytes)
+  {
+    PerCacheEntry &entry = m_perCache[PerCacheSlot (m_ber, bytes)];
+    if (entry.ber == m_ber && entry.bytes == bytes)
+      {
+        return entry.per; // Flows use only a few packet sizes, so this is almost always a hit
+      }
+    // -expm1 (n * log1p (-ber)) is 1 - (1 - ber)^n without losing precision for tiny BERs
+    double per = -std::expm1 (bytes * 8.0 * m_logOneMinusBer);
+    entry.ber = m_ber;
+    entry.bytes = bytes;
+    entry.per = per;
+    return per;
+  }
+
+  // Samples which of 'bits' bits are in error and writes their (increasing) positions to 'positions'.
+  // The gap before the next error is geometric, floor (ln (U) / ln (1 - BER)), so we jump from error to
+  // error: the cost is one draw per error plus one, i.e. about one draw per packet at BER 1e-7.
+  virtual uint32_t SampleBitErrors (uint32_t bits, std::vector<uint32_t> &positions)
+  {
+    return SampleBitErrors (bits, positions, m_defaultRng);
+  }
+
+  // Positions of the bits found in error by the last GEOMETRIC decision
+  const std::vector<uint32_t> &GetLastErrorPositions () const { return m_errorPositions; }
+
+protected:
+  // The decision logic is written once against any RNG policy; OpticalErrorModelRng instantiates it
+  // with its own policy so the draws inline, the base class uses the ns-3 default stream.
+  template <class Rng>
+  uint32_t SampleBitErrors (uint32_t bits, std::vector<uint32_t> &positions, Rng &rng)
+  {
+    positions.clear ();
+    if (m_ber <= 0.0)
+      {
+        return 0;
+      }
+    if (m_ber >= 1.0)
+      {
+        for (uint32_t i = 0; i < bits; ++i)
+          {
+            positions.push_back (i); // Every bit is in error
+          }
+        return bits;
+      }
+    uint64_t pos = 0;
+    while (true)
+      {
+        // 1 - U lies in (0, 1], so the log is finite and the gap is never negative
+        double gap = std::floor (std::log (1.0 - rng.Uniform ()) / m_logOneMinusBer);
+        if (gap >= static_cast<double> (bits - pos))
+          {
+            break; // The next error falls beyond the end of the packet
+          }
+        pos += static_cast<uint64_t> (gap);
+        positions.push_back (static_cast<uint32_t> (pos));
+        ++pos;
+      }
+    return static_cast<uint32_t> (positions.size ());
+  }
+
+  // Packet corruption logic, plus the counters
+  template <class Rng>
+  bool Decide (Ptr<Packet> p, Rng &rng)
+  {
+    ++m_packetsInspected;
+    if (m_role == TRANSIT)
+      {
+        AddHopImpairment (p); // The endpoint decides for the whole lightpath
+        return false;
+      }
+    OpticalImpairmentTag impairment;
+    if (m_role == TERMINATION && p->RemovePacketTag (impairment))
+      {
+        return DecideLightpath (p->GetSize (), impairment, rng);
+      }
+    if (!Sample (p, rng))
+      {
+        return false;
+      }
+    ++m_packetsCorrupted;
+    if (m_mode == GEOMETRIC && m_isBias <= 1.0)
+      {
+        m_bitErrors += m_errorPositions.size ();
+      }
+    else
+      { // Given at least one error, the packet holds bits * BER / PER errored bits on average
+        uint32_t bytes = p->GetSize ();
+        double per = GetPacketErrorRate (bytes);
+        m_bitErrors += per > 0.0 ? std::max (1.0, bytes * 8.0 * m_ber / per) : 1.0;
+      }
+    return true;
+  }
+
+  template <class Rng>
+  bool Sample (Ptr<Packet> p, Rng &rng)
+  {
+    if (m_trace)
+      {
+        ApplyTrace ();
+      }
+    if (m_burst)
+      {
+        AdvanceBurstState (rng); // Picks the BER of the state the channel is in now
+      }
+    if (m_isBias > 1.0)
+      {
+        return DecideBiased (p->GetSize (), rng);
+      }
+    if (m_mode == CLOSED_FORM)
+      {
+        return rng.Uniform () < GetPacketErrorRate (p->GetSize ()); // One draw per packet
+      }
+    if (m_mode == GEOMETRIC)
+      {
+        if (SampleBitErrors (p->GetSize () * 8, m_errorPositions, rng) == 0)
+          {
+            return false;
+          }
+        if (m_flipBits)
+          {
+            FlipBits (p); // Drop traces and downstream CRC/FEC models see the real corrupted bytes
+          }
+        return true;
+      }
+
+    // Very basic bit-flip approach: one variate per bit, generated and compared against the BER in blocks
+    uint32_t bits = p->GetSize () * 8;
+    return FirstErrorBit (rng, m_ber, bits) < bits; // Corrupt if any bit is in error
+  }
+
+  template <class Rng>
+  bool DecideBiased (uint32_t bytes, Rng &rng)
+  {
+    double per = GetPacketErrorRate (bytes);
+    double biased;
+    std::unordered_map<uint32_t, double>::const_iterator it = m_biasedPerCache.find (bytes);
+    if (it != m_biasedPerCache.end ())
+      {
+        biased = it->second;
+      }
+    else
+      {
+        // Biased BER capped at 0.5 (a coin flip per bit); never below the true PER
+        double biasedBer = std::min (0.5, m_ber * m_isBias);
+        biased = std::max (per, -std::expm1 (bytes * 8.0 * std::log1p (-biasedBer)));
+        m_biasedPerCache[bytes] = biased;
+      }
+    bool corrupt = rng.Uniform () < biased;
+    m_lastWeight = corrupt ? per / biased : (1.0 - per) / (1.0 - biased);
+    ++m_isPackets;
+    if (corrupt)
+      {
+        m_isWeightSum += m_lastWeight;
+        m_isWeightSquareSum += m_lastWeight * m_lastWeight;
+      }
+    return corrupt;
+  }
+
+  // Single decision for a tagged packet at the end of a transparent lightpath
+  template <class Rng>
+  bool DecideLightpath (uint32_t bytes, const OpticalImpairmentTag &impairment, Rng &rng)
+  {
+    if (m_trace)
+      {
+        ApplyTrace ();
+      }
+    double noiseToSignal = impairment.GetNoiseToSignal () + m_hopNoiseToSignal;
+    if (noiseToSignal != m_pathNoiseToSignal)
+      { // Packets of one lightpath carry the same total, so the table lookup runs once per path change
+        m_pathNoiseToSignal = noiseToSignal;
+        m_pathBer = m_fec.PostFecBer (QFunctionTable::Get ().Ber (m_modulation, 1.0 / noiseToSignal));
+        m_pathLogOneMinusBer = std::log1p (-m_pathBer);
+      }
+    double bits = bytes * 8.0;
+    double per = -std::expm1 (bits * m_pathLogOneMinusBer);
+    if (rng.Uniform () >= per)
+      {
+        return false;
+      }
+    ++m_packetsCorrupted;
+    m_bitErrors += per > 0.0 ? std::max (1.0, bits * m_pathBer / per) : 1.0;
+    return true;
+  }
+
+  uint64_t GetStreamKey () const { return m_streamKey; }
+
+private:
+  struct PerCacheEntry
+  {
+    double ber; // Post-FEC BER the PER was computed for (NaN: empty)
+    uint32_t bytes; // Packet size
+    double per; // 1 - (1 - ber)^(8 * bytes)
+  };
+
+  static const uint32_t PER_CACHE_SLOTS = 64; // PER cache size (power of two)
+
+  // Slot of a (BER, packet size) pair in the PER cache
+  static uint32_t PerCacheSlot (double ber, uint32_t bytes)
+  {
+    uint64_t key;
+    std::memcpy (&key, &ber, sizeof (key));
+    key = (key ^ (key >> 32) ^ bytes) * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+    return static_cast<uint32_t> (key >> 32) & (PER_CACHE_SLOTS - 1);
+  }
+
+  virtual bool DoCorrupt (Ptr<Packet> p) override
+  {
+    return Decide (p, m_defaultRng);
+  }
+
+  void AddHopImpairment (Ptr<Packet> p)
+  {
+    if (m_trace)
+      {
+        ApplyTrace (); // An SNR trace moves this hop's noise
+      }
+    OpticalImpairmentTag impairment;
+    bool tagged = p->PeekPacketTag (impairment);
+    impairment.AddHop (m_hopNoiseToSignal);
+    if (tagged)
+      {
+        p->ReplacePacketTag (impairment);
+      }
+    else
+      {
+        p->AddPacketTag (impairment);
+      }
+  }
+
+  // Pulls the trace value for Now (); the BER (and its PER cache) only changes when the sample does
+  void ApplyTrace ()
+  {
+    double value = m_trace->Lookup (Simulator::Now ());
+    if (value == m_lastTraceValue)
+      {
+        return;
+      }
+    m_lastTraceValue = value;
+    double ber = value;
+    if (m_trace->GetKind () == OpticalTrace::SNR_DB)
+      {
+        m_snrDb = value;
+        m_hopNoiseToSignal = std::pow (10.0, -value / 10.0);
+        ber = QFunctionTable::Get ().BerFromSnrDb (m_modulation, value);
+      }
+    if (m_burst)
+      {
+        m_goodBer = ber; // The burst state machine applies it
+      }
+    else
+      {
+        SetBer (ber);
+      }
+  }
+
+  // Samples the good/bad state at Now () given the state at the previous packet. For a two-state
+  // continuous-time Markov chain P(bad at t + dt) = piBad + (1[bad at t] - piBad) * exp (-(a + b) dt),
+  // with a, b the two transition rates and piBad = a / (a + b), so one draw covers any gap.
+  template <class Rng>
+  void AdvanceBurstState (Rng &rng)
+  {
+    double totalRate = m_goodToBadRate + m_badToGoodRate;
+    double piBad = totalRate > 0.0 ? m_goodToBadRate / totalRate : 0.0;
+    double pBad = piBad;
+    Time now = Simulator::Now ();
+    if (m_burstStarted)
+      {
+        double decay = std::exp (-totalRate * (now - m_lastBurstUpdate).GetSeconds ());
+        pBad = piBad + ((m_inBadState ? 1.0 : 0.0) - piBad) * decay;
+      }
+    m_burstStarted = true;
+    m_lastBurstUpdate = now;
+
+    bool bad = rng.Uniform () < pBad;
+    double ber = bad ? m_badBer : m_goodBer;
+    if (bad != m_inBadState || ber != m_channelBer)
+      {
+        SetBer (ber); // Only on a state change, so the PER cache survives within a burst
+      }
+    m_inBadState = bad;
+  }
+
+  // Rewrites the packet payload with the bits in m_errorPositions inverted (bit 0 is the MSB of byte 0)
+  void FlipBits (Ptr<Packet> p)
+  {
+    uint32_t size = p->GetSize ();
+    std::vector<uint8_t> buffer (size);
+    p->CopyData (buffer.data (), size);
+    for (uint32_t pos : m_errorPositions)
+      {
+        buffer[pos >> 3] ^= static_cast<uint8_t> (0x80 >> (pos & 7));
+      }
+    // Swap the bytes in place; packet tags stay attached to p
+    p->RemoveAtStart (size);
+    p->AddAtEnd (Create<Packet> (buffer.data (), size));
+  }
+
+  virtual void DoReset () override
+  {
+    m_packetsInspected = 0;
+    m_packetsCorrupted = 0;
+    m_bitErrors = 0.0;
+  }
+
+  Mrg32k3aRng m_defaultRng; // RNG for the corruption (ns-3 default stream)
+  uint32_t m_wavelengthId; // Wavelength this model sits on
+  uint64_t m_streamKey; // Hash of (RngSeed, RngRun, wavelength id) keying the per-packet streams
+  double m_ber; // BER the packets experience (post-FEC)
+  double m_channelBer; // Channel (pre-FEC) BER
+  FecModel m_fec; // FEC stage
+  double m_snrDb; // SNR
+  CorruptMode m_mode; // Per-bit loop or closed-form PER
+  bool m_flipBits; // GEOMETRIC mode: flip the errored bits in the packet buffer
+  bool m_snrDriven; // Derive the BER from m_snrDb instead of using the value given to SetBer
+  ModulationFormat m_modulation; // Format used for the SNR -> BER mapping
+  bool m_burst; // Gilbert-Elliott burst mode enabled
+  bool m_burstStarted; // False until the first packet has drawn an initial state
+  bool m_inBadState; // Current Gilbert-Elliott state
+  double m_goodBer; // BER in the good state
+  double m_badBer; // BER in the bad (burst) state
+  double m_goodToBadRate; // Good -> bad transitions per second
+  double m_badToGoodRate; // Bad -> good transitions per second
+  Time m_lastBurstUpdate; // Sim time the state was last sampled
+  Ptr<OpticalTrace> m_trace; // Optional BER/SNR trace
+  double m_lastTraceValue; // Trace value currently applied (NaN before the first packet)
+  LightpathRole m_role; // Single hop, transit or termination of a transparent lightpath
+  double m_hopNoiseToSignal; // 10^(-m_snrDb / 10): this hop's share of a lightpath's noise
+  double m_pathNoiseToSignal; // Lightpath total the cached BER below was computed for
+  double m_pathBer; // Post-FEC BER at that total
+  double m_pathLogOneMinusBer; // ln (1 - m_pathBer)
+  double m_logOneMinusBer; // ln (1 - BER), cached for the PER formula and the gap sampler
+  std::vector<PerCacheEntry> m_perCache; // Direct-mapped on (BER, size); a new BER just misses
+  double m_isBias; // Importance-sampling BER bias (1 = off)
+  uint64_t m_isPackets; // Packets decided with importance sampling
+  double m_isWeightSum; // Sum of w * 1[corrupted]
+  double m_isWeightSquareSum; // Sum of (w * 1[corrupted])^2
+  double m_lastWeight; // Likelihood ratio of the last decision
+  std::unordered_map<uint32_t, double> m_biasedPerCache; // Packet size (bytes) -> biased PER
+  TracedValue<uint64_t> m_packetsInspected; // Packets decided on
+  TracedValue<uint64_t> m_packetsCorrupted; // Packets corrupted
+  TracedValue<double> m_bitErrors; // Estimated errored bits
+  std::vector<uint32_t> m_errorPositions; // Errored bit positions of the last GEOMETRIC decision
+};
+
+template <class Rng>
+class OpticalErrorModelRng : public OpticalErrorModel
+{ // Same model, but every draw goes through an inlined RNG policy (see RNG Policies above) whose stream
+  // is re-keyed per packet from (RngSeed, RngRun, wavelength id, packet uid): parallel replications and
+  // reordered events reproduce the same decisions for the same packets.
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ((std::string ("OpticalErrorModel<") + Rng::Name () + ">").c_str ())
+      .SetParent<OpticalErrorModel> ()
+      .SetGroupName("Network")
+      .AddConstructor<OpticalErrorModelRng<Rng> > ();
+    return tid;
+  }
+
+  virtual uint32_t SampleBitErrors (uint32_t bits, std::vector<uint32_t> &positions) override
+  {
+    return OpticalErrorModel::SampleBitErrors (bits, positions, m_rng);
+  }
+
+private:
+  virtual bool DoCorrupt (Ptr<Packet> p) override
+  {
+    m_rng.BeginPacket (GetStreamKey (), p->GetUid ());
+    return Decide (p, m_rng);
+  }
+
+  Rng m_rng; // Inlined policy
+};
+
+// ------------------ Amplified Span Chain ------------------
+class AmplifiedLink
+{ // A link of fiber spans, each followed by an inline EDFA. The signal and the ASE of every amplifier
+  // are carried through the chain once (Compute), giving the OSNR after each span and at the receiver;
+  // the receiver's OpticalErrorModel is then given the resulting SNR, so the per-packet cost of a
+  // 40-span link is the same as of a single hop.
+public:
+  struct Span
+  {
+    double lengthKm; // Fiber length
+    double alphaDbPerKm; // Attenuation
+    double extraLossDb; // Connectors, splices, ROADM pass-through
+    double gainDb; // EDFA gain; <= 0: exactly the span loss
+    double noiseFigureDb; // EDFA noise figure
+  };
+
+  AmplifiedLink ()
+    : m_launchPowerDbm (0.0),
+      m_valid (false)
+  {
+  }
+
+  // Adds count identical spans
+  void AddSpans (uint32_t count, const Span &span)
+  {
+    m_spans.insert (m_spans.end (), count, span);
+    m_valid = false;
+  }
+  void SetLaunchPowerDbm (double dbm)
+  {
+    m_launchPowerDbm = dbm;
+    m_valid = false;
+  }
+
+  uint32_t GetNSpans () const { return static_cast<uint32_t> (m_spans.size ()); }
+
+  // OSNR in the 0.1 nm (12.5 GHz) reference bandwidth after span k (0-based), and at the receiver
+  double GetSpanOsnrDb (uint32_t k)
+  {
+    Compute ();
+    return m_osnrDb[k];
+  }
+  double GetOsnrDb ()
+  {
+    Compute ();
+    return m_osnrDb.empty () ? std::numeric_limits<double>::infinity () : m_osnrDb.back ();
+  }
+
+  // SNR in the signal bandwidth (the symbol rate) at the receiver
+  double GetSnrDb (double symbolRateHz) { return GetOsnrDb () + 10.0 * std::log10 (REFERENCE_BANDWIDTH_HZ / symbolRateHz); }
+
+  // Makes the error model SNR-driven with this link's receiver SNR
+  void Apply (Ptr<OpticalErrorModel> errorModel, ModulationFormat format, DataRate rate)
+  {
+    double bitsPerSymbol = format == OOK ? 1.0 : format == DP_QPSK ? 4.0 : 8.0; // Both polarisations
+    errorModel->SetSnrDriven (true, format);
+    errorModel->SetSnrDb (GetSnrDb (rate.GetBitRate () / bitsPerSymbol));
+  }
+
+  static const double REFERENCE_BANDWIDTH_HZ;
+
+private:
+  void Compute ()
+  {
+    if (m_valid)
+      {
+        return;
+      }
+    const double photonEnergy = 6.62607015e-34 * 193.4e12; // h * nu at 1550 nm
+    double signal = 1e-3 * std::pow (10.0, m_launchPowerDbm / 10.0); // W, per channel
+    double ase = 0.0; // W in the reference bandwidth
+    m_osnrDb.resize (m_spans.size ());
+    for (uint32_t k = 0; k < m_spans.size (); ++k)
+      {
+        const Span &span = m_spans[k];
+        double lossDb = span.lengthKm * span.alphaDbPerKm + span.extraLossDb;
+        double gainDb = span.gainDb > 0.0 ? span.gainDb : lossDb;
+        double net = std::pow (10.0, (gainDb - lossDb) / 10.0); // Span loss then amplifier gain
+        double gain = std::pow (10.0, gainDb / 10.0);
+        double nf = std::pow (10.0, span.noiseFigureDb / 10.0);
+        signal *= net;
+        ase = ase * net + nf * photonEnergy * (gain - 1.0) * REFERENCE_BANDWIDTH_HZ; // Earlier ASE rides along
+        m_osnrDb[k] = 10.0 * std::log10 (signal / ase);
+      }
+    m_valid = true;
+  }
+
+  std::vector<Span> m_spans; // In propagation order
+  double m_launchPowerDbm; // Per-channel launch power
+  std::vector<double> m_osnrDb; // Accumulated OSNR after each span
+  bool m_valid; // m_osnrDb matches the spans and launch power
+};
+
+const double AmplifiedLink::REFERENCE_BANDWIDTH_HZ = 12.5e9;
+
+// ------------------ Shared-Fiber WDM Channel ------------------
+// One WdmFiberChannel carries every wavelength between two nodes. Each wavelength is a pair of
+// lightweight WdmNetDevices (one IP interface per lambda, as before) with its own DataRate, delay and
+// receive error model. Serialisation is computed analytically (a lambda's transmitter is busy until a
+// known time), so devices schedule no per-packet events. The fiber keeps a single pending delivery
+// event for all its wavelengths and hands over every packet due in the same slot when it fires.
+class WdmNetDevice;
+
+class WdmLambdaChannel : public Channel
+{ // Stateless two-device view of one wavelength (or of a bonded pair, see WdmBondNetDevice), returned by
+  // GetChannel so code that expects a point-to-point channel (e.g. global routing) sees exactly two ends
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("WdmLambdaChannel")
+      .SetParent<Channel> ()
+      .SetGroupName("PointToPoint");
+    return tid;
+  }
+
+  WdmLambdaChannel (Ptr<NetDevice> a, Ptr<NetDevice> b)
+  {
+    m_ends[0] = a;
+    m_ends[1] = b;
+  }
+
+
+  virtual std::size_t GetNDevices (void) const override { return 2; }
+  virtual Ptr<NetDevice> GetDevice (std::size_t i) const override { return m_ends[i]; }
+
+protected:
+  virtual void DoDispose (void) override
+  {
+    m_ends[0] = 0;
+    m_ends[1] = 0;
+    Channel::DoDispose ();
+  }
+
+private:
+  Ptr<NetDevice> m_ends[2]; // The two devices on this wavelength
+};
+
+class WdmFiberChannel : public Channel
+{
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("WdmFiberChannel")
+      .SetParent<Channel> ()
+      .SetGroupName("PointToPoint")
+      .AddConstructor<WdmFiberChannel> ()
+      .AddAttribute ("CoalescingSlot", "Deliveries are rounded up to this granularity and handed over together "
+                     "(0: only deliveries due at exactly the same time are coalesced)",
+                     TimeValue (Seconds (0)),
+                     MakeTimeAccessor (&WdmFiberChannel::m_slot),
+                     MakeTimeChecker ());
+    return tid;
+  }
+
+  WdmFiberChannel ()
+    : m_sequence (0)
+  {
+  }
+
+  // Adds a wavelength between the two given devices and returns its index on this fiber
+  uint32_t AddWavelength (Ptr<WdmNetDevice> a, Ptr<WdmNetDevice> b, Time delay);
+
+  // Makes the wavelength a transparent lightpath over several hops: every packet received by the given
+  // end first goes through these models, the hops before it in propagation order (normally
+  // OpticalErrorModel::TRANSIT, which only tag the packet with their noise), then through the
+  // receiver's own error model. Each direction crosses the hops in its own order, so each end has its
+  // list.
+  void SetTransitErrorModels (uint32_t lambda, Ptr<WdmNetDevice> receiver,
+                              const std::vector<Ptr<OpticalErrorModel> > &models);
+  const std::vector<Ptr<OpticalErrorModel> > &GetTransitErrorModels (uint32_t lambda, const WdmNetDevice *receiver) const;
+
+  // Called by a device: the packet has finished serialising at txEnd and reaches the far end one
+  // propagation delay later
+  void Transmit (Ptr<Packet> packet, uint16_t protocol, uint32_t lambda, Ptr<WdmNetDevice> src, Time txEnd);
+
+  uint32_t GetNWavelengths () const { return static_cast<uint32_t> (m_lambdas.size ()); }
+  Time GetDelay (uint32_t lambda) const { return m_lambdas[lambda].delay; }
+
+  virtual std::size_t GetNDevices (void) const override { return m_lambdas.size () * 2; }
+  virtual Ptr<NetDevice> GetDevice (std::size_t i) const override;
+
+protected:
+  virtual void DoDispose (void) override
+  {
+    m_lambdas.clear (); // Devices and fiber point at each other
+    m_pending = std::priority_queue<Delivery, std::vector<Delivery>, std::greater<Delivery> > ();
+    m_deliveryEvent.Cancel ();
+    Channel::DoDispose ();
+  }
+
+private:
+  struct Lambda
+  {
+    Time delay; // Propagation delay (plus FEC decoding) of this wavelength
+    Ptr<WdmNetDevice> ends[2]; // The two devices on this wavelength
+    std::vector<Ptr<OpticalErrorModel> > transit[2]; // Per receiving end: hops a transparent lightpath crosses to it
+  };
+
+  struct Delivery
+  {
+    Time at; // Arrival time at the far end
+    uint64_t sequence; // Keeps packets of a wavelength in order when arrival times tie
+    Ptr<Packet> packet;
+    uint16_t protocol;
+    Ptr<WdmNetDevice> dst;
+    Ptr<WdmNetDevice> src;
+
+    bool operator> (const Delivery &other) const
+    {
+      return at > other.at || (at == other.at && sequence > other.sequence);
+    }
+  };
+
+  void DeliverDue ();
+  void DeliverBatch (const std::vector<Delivery> &batch);
+  void ScheduleNext ();
+
+  std::vector<Lambda> m_lambdas; // Wavelengths on this fiber
+  std::priority_queue<Delivery, std::vector<Delivery>, std::greater<Delivery> > m_pending; // In flight
+  EventId m_deliveryEvent; // The fiber's one pending delivery event
+  Time m_deliveryAt; // When m_deliveryEvent fires
+  Time m_slot; // Coalescing granularity
+  uint64_t m_sequence; // Next Delivery::sequence
+};
+
+class WdmNetDevice : public NetDevice
+{ // One end of one wavelength on a WdmFiberChannel
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("WdmNetDevice")
+      .SetParent<NetDevice> ()
+      .SetGroupName("PointToPoint")
+      .AddConstructor<WdmNetDevice> ()
+      .AddAttribute ("DataRate", "Line rate of this wavelength",
+                     DataRateValue (DataRate ("10Gbps")),
+                     MakeDataRateAccessor (&WdmNetDevice::m_dataRate),
+                     MakeDataRateChecker ())
+      .AddAttribute ("ReceiveErrorModel", "Error model applied to packets received on this wavelength",
+                     PointerValue (),
+                     MakePointerAccessor (&WdmNetDevice::m_receiveErrorModel),
+                     MakePointerChecker<ErrorModel> ())
+      .AddAttribute ("MaxQueuePackets", "Packets that may wait for the transmitter before tail drop",
+                     UintegerValue (100),
+                     MakeUintegerAccessor (&WdmNetDevice::m_maxQueuePackets),
+                     MakeUintegerChecker<uint32_t> (1))
+      .AddTraceSource ("MacTxDrop", "Packet dropped because the transmit queue was full",
+                       MakeTraceSourceAccessor (&WdmNetDevice::m_macTxDropTrace),
+                       "ns3::Packet::TracedCallback")
+      .AddTraceSource ("PhyRxDrop", "Packet dropped by the receive error model",
+                       MakeTraceSourceAccessor (&WdmNetDevice::m_phyRxDropTrace),
+                       "ns3::Packet::TracedCallback")
+      .AddTraceSource ("MacRx", "Packet received and passed up the stack",
+                       MakeTraceSourceAccessor (&WdmNetDevice::m_macRxTrace),
+                       "ns3::Packet::TracedCallback");
+    return tid;
+  }
+
+  WdmNetDevice ()
+    : m_ifIndex (0),
+      m_mtu (1500),
+      m_lambda (0),
+      m_maxQueuePackets (100)
+  {
+  }
+
+  void Attach (Ptr<WdmFiberChannel> fiber, uint32_t lambda, Ptr<WdmLambdaChannel> view)
+  {
+    m_fiber = fiber;
+    m_lambda = lambda;
+    m_view = view;
+    m_linkChangeCallbacks ();
+  }
+
+  void SetDataRate (DataRate rate) { m_dataRate = rate; }
+  void SetReceiveErrorModel (Ptr<ErrorModel> em) { m_receiveErrorModel = em; }
+  DataRate GetDataRate () const { return m_dataRate; }
+  uint32_t GetWavelength () const { return m_lambda; }
+  Ptr<WdmFiberChannel> GetFiber () const { return m_fiber; }
+
+  // Time at which the transmitter will have sent everything queued so far
+  Time GetBusyUntil () const { return std::max (m_busyUntil, Simulator::Now ()); }
+
+  // Called by the fiber when a packet arrives on this wavelength
+  void Receive (Ptr<Packet> packet, uint16_t protocol, Ptr<WdmNetDevice> src)
+  {
+    if (LostOnLightpath (packet) || (m_receiveErrorModel && m_receiveErrorModel->IsCorrupt (packet)))
+      {
+        m_phyRxDropTrace (packet);
+        return;
+      }
+    m_macRxTrace (packet);
+    if (!m_promiscCallback.IsNull ())
+      {
+        m_promiscCallback (this, packet, protocol, src->GetAddress (), m_address, NetDevice::PACKET_HOST);
+      }
+    m_rxCallback (this, packet, protocol, src->GetAddress ());
+  }
+
+  // NetDevice
+  virtual void SetIfIndex (const uint32_t index) override { m_ifIndex = index; }
+  virtual uint32_t GetIfIndex (void) const override { return m_ifIndex; }
+  virtual Ptr<Channel> GetChannel (void) const override { return m_view; }
+  virtual void SetAddress (Address address) override { m_address = Mac48Address::ConvertFrom (address); }
+  virtual Address GetAddress (void) const override { return m_address; }
+  virtual bool SetMtu (const uint16_t mtu) override
+  {
+    m_mtu = mtu;
+    return true;
+  }
+  virtual uint16_t GetMtu (void) const override { return m_mtu; }
+  virtual bool IsLinkUp (void) const override { return m_fiber != 0; }
+  virtual void AddLinkChangeCallback (Callback<void> callback) override { m_linkChangeCallbacks.ConnectWithoutContext (callback); }
+  virtual bool IsBroadcast (void) const override { return true; }
+  virtual Address GetBroadcast (void) const override { return Mac48Address::GetBroadcast (); }
+  virtual bool IsMulticast (void) const override { return true; }
+  virtual Address GetMulticast (Ipv4Address multicastGroup) const override { return Mac48Address::GetMulticast (multicastGroup); }
+  virtual Address GetMulticast (Ipv6Address addr) const override { return Mac48Address::GetMulticast (addr); }
+  virtual bool IsBridge (void) const override { return false; }
+  virtual bool IsPointToPoint (void) const override { return true; }
+  virtual bool Send (Ptr<Packet> packet, const Address & /* dest */, uint16_t protocolNumber) override
+  { // Point to point: the far end of the wavelength is the only receiver
+    if (!IsLinkUp ())
+      {
+        m_macTxDropTrace (packet);
+        return false;
+      }
+    // The queue is virtual: we only remember when each queued packet finishes serialising
+    Time now = Simulator::Now ();
+    while (!m_txEnds.empty () && m_txEnds.front () <= now)
+      {
+        m_txEnds.pop_front ();
+      }
+    if (m_txEnds.size () >= m_maxQueuePackets)
+      {
+        m_macTxDropTrace (packet);
+        return false;
+      }
+    m_busyUntil = std::max (m_busyUntil, now) + m_dataRate.CalculateBytesTxTime (packet->GetSize ());
+    m_txEnds.push_back (m_busyUntil);
+    m_fiber->Transmit (packet, protocolNumber, m_lambda, this, m_busyUntil);
+    return true;
+  }
+  virtual bool SendFrom (Ptr<Packet>, const Address &, const Address &, uint16_t) override
+  {
+    return false;
+  }
+  virtual Ptr<Node> GetNode (void) const override { return m_node; }
+  virtual void SetNode (Ptr<Node> node) override { m_node = node; }
+  virtual bool NeedsArp (void) const override { return false; }
+  virtual void SetReceiveCallback (NetDevice::ReceiveCallback cb) override { m_rxCallback = cb; }
+  virtual void SetPromiscReceiveCallback (NetDevice::PromiscReceiveCallback cb) override { m_promiscCallback = cb; }
+  virtual bool SupportsSendFrom (void) const override { return false; }
+
+protected:
+  virtual void DoDispose (void) override
+  {
+    m_fiber = 0;
+    m_view = 0;
+    m_node = 0;
+    m_receiveErrorModel = 0;
+    m_rxCallback.Nullify ();
+    m_promiscCallback.Nullify ();
+    NetDevice::DoDispose ();
+  }
+
+private:
+  // Runs the transit hops of a transparent lightpath ending here; TRANSIT models only tag the packet,
+  // any other model may drop it on its own hop
+  bool LostOnLightpath (Ptr<Packet> packet)
+  {
+    if (!m_fiber)
+      {
+        return false;
+      }
+    for (const Ptr<OpticalErrorModel> &hop : m_fiber->GetTransitErrorModels (m_lambda, this))
+      {
+        if (hop->IsCorrupt (packet))
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+
+  Ptr<Node> m_node; // Node this device is installed on
+  Ptr<WdmFiberChannel> m_fiber; // Fiber carrying this wavelength
+  Ptr<WdmLambdaChannel> m_view; // Two-device view of this wavelength
+  Mac48Address m_address; // MAC address
+  uint32_t m_ifIndex; // Interface index on the node
+  uint16_t m_mtu; // MTU in bytes
+  uint32_t m_lambda; // Wavelength index on m_fiber
+  DataRate m_dataRate; // Line rate of this wavelength
+  Ptr<ErrorModel> m_receiveErrorModel; // Receive-side error model
+  uint32_t m_maxQueuePackets; // Tail-drop limit of the virtual queue
+  Time m_busyUntil; // When the transmitter becomes idle
+  std::deque<Time> m_txEnds; // Serialisation end of each queued packet, oldest first
+  NetDevice::ReceiveCallback m_rxCallback; // Up the stack
+  NetDevice::PromiscReceiveCallback m_promiscCallback; // Promiscuous sniffers
+  TracedCallback<> m_linkChangeCallbacks; // Link state listeners
+  TracedCallback<Ptr<const Packet> > m_macTxDropTrace;
+  TracedCallback<Ptr<const Packet> > m_phyRxDropTrace;
+  TracedCallback<Ptr<const Packet> > m_macRxTrace;
+};
+
+uint32_t
+WdmFiberChannel::AddWavelength (Ptr<WdmNetDevice> a, Ptr<WdmNetDevice> b, Time delay)
+{
+  Lambda lambda;
+  lambda.delay = delay;
+  lambda.ends[0] = a;
+  lambda.ends[1] = b;
+  m_lambdas.push_back (lambda);
+  uint32_t index = static_cast<uint32_t> (m_lambdas.size () - 1);
+  Ptr<WdmLambdaChannel> view = CreateObject<WdmLambdaChannel> (a, b);
+  a->Attach (this, index, view);
+  b->Attach (this, index, view);
+  return index;
+}
+
+void
+WdmFiberChannel::SetTransitErrorModels (uint32_t lambda, Ptr<WdmNetDevice> receiver,
+                                        const std::vector<Ptr<OpticalErrorModel> > &models)
+{
+  Lambda &l = m_lambdas[lambda];
+  l.transit[l.ends[1] == receiver ? 1 : 0] = models;
+}
+
+const std::vector<Ptr<OpticalErrorModel> > &
+WdmFiberChannel::GetTransitErrorModels (uint32_t lambda, const WdmNetDevice *receiver) const
+{
+  const Lambda &l = m_lambdas[lambda];
+  return l.transit[PeekPointer (l.ends[1]) == receiver ? 1 : 0];
+}
+
+Ptr<NetDevice>
+WdmFiberChannel::GetDevice (std::size_t i) const
+{
+  return m_lambdas[i / 2].ends[i % 2];
+}
+
+void
+WdmFiberChannel::Transmit (Ptr<Packet> packet, uint16_t protocol, uint32_t lambda, Ptr<WdmNetDevice> src, Time txEnd)
+{
+  const Lambda &l = m_lambdas[lambda];
+  Delivery delivery;
+  delivery.at = txEnd + l.delay;
+  if (m_slot.IsStrictlyPositive ())
+    { // Round up to the slot boundary so nearby arrivals share one event
+      int64_t slots = (delivery.at.GetTimeStep () + m_slot.GetTimeStep () - 1) / m_slot.GetTimeStep ();
+      delivery.at = Time (slots * m_slot.GetTimeStep ());
+    }
+  delivery.sequence = m_sequence++;
+  delivery.packet = packet;
+  delivery.protocol = protocol;
+  delivery.src = src;
+  delivery.dst = l.ends[0] == src ? l.ends[1] : l.ends[0];
+  m_pending.push (delivery);
+  if (!m_deliveryEvent.IsRunning () || delivery.at < m_deliveryAt)
+    {
+      ScheduleNext (); // A faster wavelength can overtake the one we were waiting for
+    }
+}
+
+void
+WdmFiberChannel::ScheduleNext ()
+{
+  m_deliveryEvent.Cancel ();
+  if (m_pending.empty ())
+    {
+      return;
+    }
+  m_deliveryAt = m_pending.top ().at;
+  m_deliveryEvent = Simulator::Schedule (m_deliveryAt - Simulator::Now (), &WdmFiberChannel::DeliverDue, this);
+}
+
+void
+WdmFiberChannel::DeliverDue ()
+{
+  Time now = Simulator::Now ();
+  // The slot's packets are grouped by destination node and each group is handed over in one event
+  // in that node's context; a fiber joins two nodes, so that is at most two events per slot
+  std::vector<std::pair<uint32_t, std::vector<Delivery> > > batches;
+  while (!m_pending.empty () && m_pending.top ().at <= now)
+    {
+      Delivery delivery = m_pending.top ();
+      m_pending.pop ();
+      // Like PointToPointChannel: the receiver gets its own copy (header removal and tags on the
+      // receive side must not touch the sender's packet)
+      delivery.packet = delivery.packet->Copy ();
+      uint32_t context = delivery.dst->GetNode ()->GetId ();
+      uint32_t b = 0;
+      while (b < batches.size () && batches[b].first != context)
+        {
+          ++b;
+        }
+      if (b == batches.size ())
+        {
+          batches.push_back (std::make_pair (context, std::vector<Delivery> ()));
+        }
+      batches[b].second.push_back (delivery);
+    }
+  for (const std::pair<uint32_t, std::vector<Delivery> > &batch : batches)
+    {
+      if (batch.first == Simulator::GetContext ())
+        {
+          DeliverBatch (batch.second);
+        }
+      else
+        {
+          Simulator::ScheduleWithContext (batch.first, Seconds (0), &WdmFiberChannel::DeliverBatch, this, batch.second);
+        }
+    }
+  ScheduleNext ();
+}
+
+void
+WdmFiberChannel::DeliverBatch (const std::vector<Delivery> &batch)
+{
+  for (const Delivery &delivery : batch)
+    {
+      delivery.dst->Receive (delivery.packet, delivery.protocol, delivery.src);
+    }
+}
+
+class WdmFiberHelper
+{ // Creates one fiber between two nodes and adds wavelengths to it directly, without per-link helpers
+public:
+  WdmFiberHelper (Ptr<Node> a, Ptr<Node> b)
+    : m_a (a),
+      m_b (b),
+      m_fiber (CreateObject<WdmFiberChannel> ())
+  {
+  }
+
+  // Returns the two devices of the new wavelength, the one on node a first
+  NetDeviceContainer AddWavelength (DataRate rate, Time delay)
+  {
+    Ptr<WdmNetDevice> devA = CreateDevice (m_a, rate);
+    Ptr<WdmNetDevice> devB = CreateDevice (m_b, rate);
+    m_fiber->AddWavelength (devA, devB, delay);
+    return NetDeviceContainer (devA, devB);
+  }
+
+  Ptr<WdmFiberChannel> GetFiber () const { return m_fiber; }
+
+private:
+  static Ptr<WdmNetDevice> CreateDevice (Ptr<Node> node, DataRate rate)
+  {
+    Ptr<WdmNetDevice> dev = CreateObject<WdmNetDevice> ();
+    dev->SetAddress (Mac48Address::Allocate ());
+    dev->SetDataRate (rate);
+    node->AddDevice (dev);
+    return dev;
+  }
+
+  Ptr<Node> m_a;
+  Ptr<Node> m_b;
+  Ptr<WdmFiberChannel> m_fiber;
+};
+
+// ------------------ Wavelength Striping (Bonded Interface) ------------------
+class WdmSequenceTag : public Tag
+{ // Bond sequence number, added by the sending WdmBondNetDevice so the receiving one can restore order
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("WdmSequenceTag")
+      .SetParent<Tag> ()
+      .SetGroupName("PointToPoint")
+      .AddConstructor<WdmSequenceTag> ();
+    return tid;
+  }
+  virtual TypeId GetInstanceTypeId (void) const override { return GetTypeId (); }
+  virtual uint32_t GetSerializedSize (void) const override { return 4; }
+  virtual void Serialize (TagBuffer i) const override { i.WriteU32 (m_seq); }
+  virtual void Deserialize (TagBuffer i) override { m_seq = i.ReadU32 (); }
+  virtual void Print (std::ostream &os) const override { os << "seq=" << m_seq; }
+
+  WdmSequenceTag () : m_seq (0) {}
+  explicit WdmSequenceTag (uint32_t seq) : m_seq (seq) {}
+  uint32_t GetSeq () const { return m_seq; }
+
+private:
+  uint32_t m_seq; // Per-bond transmit sequence number
+};
+
+class WdmResequencer
+{ // Receive-side reorder buffer for a bond. Striping one flow over lambdas with different delays
+  // (2 ms vs 5 ms) delivers it badly out of order; this holds early packets in a fixed ring indexed
+  // by sequence number (slot = seq & mask, no allocation per packet) and releases them in order. A
+  // hole that is still open Timeout after the packet behind it arrived is given up on (the packet was
+  // lost on its wavelength) and the buffer moves past it.
+public:
+  struct Stats
+  {
+    uint64_t packets; // Packets passed up
+    uint64_t reordered; // Arrived ahead of a missing one and had to wait
+    uint64_t late; // Arrived after its slot had been skipped; passed up at once, out of order
+    uint64_t holesSkipped; // Sequence numbers given up on (timeout or window overflow)
+    uint32_t maxDepth; // Largest distance ahead of the next expected sequence number
+    uint64_t sumDepth; // Sum of those distances over the reordered packets
+    Time totalHold; // Extra latency added, summed over all packets
+    Time maxHold; // Largest extra latency of one packet
+  };
+
+  typedef Callback<void, Ptr<Packet>, uint16_t, const Address &> DeliverCallback;
+
+  WdmResequencer ()
+    : m_mask (0),
+      m_nextSeq (0),
+      m_buffered (0),
+      m_timerSeq (0)
+  {
+    m_stats = Stats ();
+    SetWindow (1024);
+  }
+
+  // Window is rounded up to a power of two; only valid while the buffer is empty
+  void SetWindow (uint32_t window)
+  {
+    uint32_t size = 1;
+    while (size < window)
+      {
+        size <<= 1;
+      }
+    m_ring.assign (size, Entry ());
+    m_mask = size - 1;
+  }
+  void SetTimeout (Time timeout) { m_timeout = timeout; }
+  void SetDeliverCallback (DeliverCallback cb) { m_deliver = cb; }
+  const Stats &GetStats () const { return m_stats; }
+
+  void Receive (Ptr<Packet> packet, uint32_t seq, uint16_t protocol, const Address &from)
+  {
+    int32_t ahead = static_cast<int32_t> (seq - m_nextSeq); // Wrap-safe distance from the expected one
+    if (ahead < 0)
+      { // Its slot was already skipped: holding it would not restore order
+        ++m_stats.late;
+        Deliver (packet, protocol, from, Simulator::Now ());
+        return;
+      }
+    if (m_buffered == 0 && static_cast<uint32_t> (ahead) > m_mask)
+      { // Nothing held: jump straight to the window that fits it
+        m_stats.holesSkipped += static_cast<uint32_t> (ahead) - m_mask;
+        m_nextSeq = seq - m_mask;
+        ahead = static_cast<int32_t> (m_mask); // Now at the far end of the window
+      }
+    if (ahead > 0)
+      {
+        ++m_stats.reordered;
+        m_stats.sumDepth += ahead;
+        m_stats.maxDepth = std::max (m_stats.maxDepth, static_cast<uint32_t> (ahead));
+      }
+    while (static_cast<uint32_t> (ahead) > m_mask)
+      { // Beyond the window: give up on the oldest hole to make room
+        SkipHead ();
+        ahead = static_cast<int32_t> (seq - m_nextSeq);
+      }
+    Entry &entry = m_ring[seq & m_mask];
+    entry.packet = packet;
+    entry.protocol = protocol;
+    entry.from = from;
+    entry.arrival = Simulator::Now ();
+    entry.used = true;
+    ++m_buffered;
+    ReleaseInOrder ();
+    ArmTimer ();
+  }
+
+  void Flush ()
+  {
+    m_timer.Cancel ();
+    while (m_buffered > 0)
+      {
+        SkipHead ();
+      }
+  }
+
+private:
+  struct Entry
+  {
+    Entry () : protocol (0), used (false) {}
+    Ptr<Packet> packet; // Held packet
+    Address from; // Source address, passed up unchanged
+    Time arrival; // When it reached the bond
+    uint16_t protocol; // L3 protocol number
+    bool used; // Slot holds a packet
+  };
+
+  void Deliver (Ptr<Packet> packet, uint16_t protocol, const Address &from, Time arrival)
+  {
+    Time hold = Simulator::Now () - arrival;
+    ++m_stats.packets;
+    m_stats.totalHold += hold;
+    m_stats.maxHold = std::max (m_stats.maxHold, hold);
+    m_deliver (packet, protocol, from);
+  }
+
+  // Passes up every packet that is now in order
+  void ReleaseInOrder ()
+  {
+    while (m_buffered > 0)
+      {
+        Entry &head = m_ring[m_nextSeq & m_mask];
+        if (!head.used)
+          {
+            return;
+          }
+        Ptr<Packet> packet = head.packet;
+        head.packet = 0;
+        head.used = false;
+        --m_buffered;
+        ++m_nextSeq;
+        Deliver (packet, head.protocol, head.from, head.arrival);
+      }
+  }
+
+  // Moves past the missing packet(s) in front of the first held one and releases what follows
+  void SkipHead ()
+  {
+    while (!m_ring[m_nextSeq & m_mask].used)
+      {
+        ++m_nextSeq;
+        ++m_stats.holesSkipped;
+        if (m_buffered == 0)
+          {
+            return;
+          }
+      }
+    ReleaseInOrder ();
+  }
+
+  // Keeps one timer pending for the oldest held packet behind the current hole. It is only moved when
+  // that packet changes, so packets that arrive in order or behind it cost no scheduler work.
+  void ArmTimer ()
+  {
+    if (m_buffered == 0)
+      {
+        m_timer.Cancel ();
+        return;
+      }
+    uint32_t seq = m_nextSeq;
+    while (!m_ring[seq & m_mask].used)
+      {
+        ++seq;
+      }
+    if (m_timer.IsRunning () && seq == m_timerSeq)
+      {
+        return;
+      }
+    m_timer.Cancel ();
+    m_timerSeq = seq;
+    Time deadline = m_ring[seq & m_mask].arrival + m_timeout;
+    Time wait = deadline > Simulator::Now () ? deadline - Simulator::Now () : Time (0);
+    m_timer = Simulator::Schedule (wait, &WdmResequencer::Timeout, this);
+  }
+
+  void Timeout ()
+  {
+    SkipHead ();
+    ArmTimer ();
+  }
+
+  std::vector<Entry> m_ring; // Reorder buffer, slot = seq & m_mask
+  uint32_t m_mask; // Ring size - 1
+  uint32_t m_nextSeq; // Next sequence number to pass up
+  uint32_t m_buffered; // Packets currently held
+  Time m_timeout; // How long a hole may hold packets back
+  EventId m_timer; // Pending hole timeout
+  uint32_t m_timerSeq; // Held packet m_timer was armed for
+  DeliverCallback m_deliver; // Where in-order packets go
+  Stats m_stats; // Reorder depth and added latency
+};
+
+class WdmBondNetDevice : public NetDevice
+{ // One logical interface over all the wavelengths between two nodes (point-to-point or shared-fiber
+  // devices alike). IP is only configured on the bond; each packet (or flowlet) goes to a wavelength
+  // picked in proportion to its DataRate times the share of packets it delivers intact, so a single
+  // flow can use the aggregate capacity. Received packets from every wavelength go up through the bond.
+public:
+  enum Policy
+  {
+    PER_PACKET, // Smooth weighted round robin over the wavelengths, per packet
+    FLOWLET,    // Same choice per flowlet: a flow sticks to a wavelength until it pauses for FlowletGap
+    LOWEST_LATENCY // Each packet to the wavelength that delivers it first (delay + serialisation + backlog)
+  };
+
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("WdmBondNetDevice")
+      .SetParent<NetDevice> ()
+      .SetGroupName("PointToPoint")
+      .AddConstructor<WdmBondNetDevice> ()
+      .AddAttribute ("FlowletGap", "Idle time after which a flow may move to another wavelength (FLOWLET policy)",
+                     TimeValue (MilliSeconds (5)),
+                     MakeTimeAccessor (&WdmBondNetDevice::m_flowletGap),
+                     MakeTimeChecker ())
+      .AddAttribute ("WeightRefresh", "How long wavelength weights are reused before the error rates are read again",
+                     TimeValue (MilliSeconds (10)),
+                     MakeTimeAccessor (&WdmBondNetDevice::m_weightRefresh),
+                     MakeTimeChecker ())
+      .AddAttribute ("Resequence", "Restore the sending order of received packets before passing them up",
+                     BooleanValue (true),
+                     MakeBooleanAccessor (&WdmBondNetDevice::m_resequence),
+                     MakeBooleanChecker ())
+      .AddAttribute ("ResequenceWindow", "Reorder buffer size in packets (rounded up to a power of two)",
+                     UintegerValue (1024),
+                     MakeUintegerAccessor (&WdmBondNetDevice::m_resequenceWindow),
+                     MakeUintegerChecker<uint32_t> (1))
+      .AddAttribute ("ResequenceTimeout", "How long a missing packet may hold back the ones behind it",
+                     TimeValue (MilliSeconds (10)),
+                     MakeTimeAccessor (&WdmBondNetDevice::m_resequenceTimeout),
+                     MakeTimeChecker ());
+    return tid;
+  }
+
+  WdmBondNetDevice ()
+    : m_ifIndex (0),
+      m_mtu (1500),
+      m_policy (PER_PACKET),
+      m_txSeq (0),
+      m_rateClassesValid (false),
+      m_weightsValid (false),
+      m_resequence (true),
+      m_resequenceWindow (1024)
+  {
+    Flowlet unused;
+    unused.slave = 0;
+    unused.used = false;
+    m_flowlets.assign (FLOWLET_SLOTS, unused);
+    m_resequencer.SetDeliverCallback (MakeCallback (&WdmBondNetDevice::DeliverUp, this));
+  }
+
+  void SetPolicy (Policy policy) { m_policy = policy; }
+
+  // Adds a wavelength with its one-way delay; remoteErrorModel is the receive error model at the far end (may be null)
+  void AddSlave (Ptr<NetDevice> slave, DataRate rate, Time delay, Ptr<OpticalErrorModel> remoteErrorModel)
+  {
+    Slave entry;
+    entry.device = slave;
+    entry.rate = rate;
+    entry.delay = delay;
+    entry.remoteErrorModel = remoteErrorModel;
+    entry.weight = 0.0;
+    entry.current = 0.0;
+    entry.txPackets = 0;
+    entry.rateClass = 0;
+    entry.classRank = 0;
+    entry.heapKey = 0;
+    m_slaves.push_back (entry);
+    m_mtu = m_slaves.size () == 1 ? slave->GetMtu () : std::min (m_mtu, slave->GetMtu ());
+    m_weightsValid = false;
+    m_rateClassesValid = false;
+    // Take over the slave's receive path (the node registered its own callback when the slave was added)
+    slave->SetReceiveCallback (MakeCallback (&WdmBondNetDevice::ReceiveFromSlave, this));
+  }
+
+  // Joins the bonds at the two ends with a two-device channel view, for global routing
+  static void Connect (Ptr<WdmBondNetDevice> a, Ptr<WdmBondNetDevice> b)
+  {
+    Ptr<WdmLambdaChannel> view = CreateObject<WdmLambdaChannel> (a, b);
+    a->m_channel = view;
+    b->m_channel = view;
+  }
+
+  uint32_t GetNSlaves () const { return static_cast<uint32_t> (m_slaves.size ()); }
+  uint64_t GetSlaveTxPackets (uint32_t i) const { return m_slaves[i].txPackets; }
+  const WdmResequencer::Stats &GetResequenceStats () const { return m_resequencer.GetStats (); }
+
+  // NetDevice
+  virtual void SetIfIndex (const uint32_t index) override { m_ifIndex = index; }
+  virtual uint32_t GetIfIndex (void) const override { return m_ifIndex; }
+  virtual Ptr<Channel> GetChannel (void) const override { return m_channel; }
+  virtual void SetAddress (Address address) override { m_address = Mac48Address::ConvertFrom (address); }
+  virtual Address GetAddress (void) const override { return m_address; }
+  virtual bool SetMtu (const uint16_t mtu) override
+  {
+    m_mtu = mtu;
+    return true;
+  }
+  virtual uint16_t GetMtu (void) const override { return m_mtu; }
+  virtual bool IsLinkUp (void) const override
+  {
+    for (const Slave &slave : m_slaves)
+      {
+        if (slave.device->IsLinkUp ())
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+  virtual void AddLinkChangeCallback (Callback<void> callback) override { m_linkChangeCallbacks.ConnectWithoutContext (callback); }
+  virtual bool IsBroadcast (void) const override { return true; }
+  virtual Address GetBroadcast (void) const override { return Mac48Address::GetBroadcast (); }
+  virtual bool IsMulticast (void) const override { return true; }
+  virtual Address GetMulticast (Ipv4Address multicastGroup) const override { return Mac48Address::GetMulticast (multicastGroup); }
+  virtual Address GetMulticast (Ipv6Address addr) const override { return Mac48Address::GetMulticast (addr); }
+  virtual bool IsBridge (void) const override { return false; }
+  virtual bool IsPointToPoint (void) const override { return true; }
+  virtual bool Send (Ptr<Packet> packet, const Address & /* dest */, uint16_t protocolNumber) override
+  { // The bond is point to point too: the chosen wavelength's far end is the receiver
+    if (m_slaves.empty ())
+      {
+        return false;
+      }
+    uint32_t index;
+    switch (m_policy)
+      {
+      case FLOWLET:
+        index = SelectFlowlet (packet);
+        break;
+      case LOWEST_LATENCY:
+        index = SelectLowestLatency (packet->GetSize ());
+        break;
+      default:
+        index = SelectWeighted ();
+        break;
+      }
+    Slave &slave = m_slaves[index];
+    ++slave.txPackets;
+    NoteSent (index, packet->GetSize ());
+    packet->AddPacketTag (WdmSequenceTag (m_txSeq++));
+    return slave.device->Send (packet, slave.device->GetBroadcast (), protocolNumber);
+  }
+  virtual bool SendFrom (Ptr<Packet>, const Address &, const Address &, uint16_t) override
+  {
+    return false;
+  }
+  virtual Ptr<Node> GetNode (void) const override { return m_node; }
+  virtual void SetNode (Ptr<Node> node) override { m_node = node; }
+  virtual bool NeedsArp (void) const override { return false; }
+  virtual void SetReceiveCallback (NetDevice::ReceiveCallback cb) override { m_rxCallback = cb; }
+  virtual void SetPromiscReceiveCallback (NetDevice::PromiscReceiveCallback cb) override { m_promiscCallback = cb; }
+  virtual bool SupportsSendFrom (void) const override { return false; }
+
+protected:
+  virtual void DoInitialize (void) override
+  {
+    m_resequencer.SetWindow (m_resequenceWindow);
+    m_resequencer.SetTimeout (m_resequenceTimeout);
+    NetDevice::DoInitialize ();
+  }
+
+  virtual void DoDispose (void) override
+  {
+    m_resequencer.Flush ();
+    m_slaves.clear ();
+    m_channel = 0;
+    m_node = 0;
+    m_rxCallback.Nullify ();
+    m_promiscCallback.Nullify ();
+    NetDevice::DoDispose ();
+  }
+
+private:
+  struct Slave
+  {
+    Ptr<NetDevice> device; // Wavelength device
+    DataRate rate; // Its line rate
+    Ptr<OpticalErrorModel> remoteErrorModel; // Receive error model at the far end, if any
+    double weight; // rate * (1 - PER at the bond MTU)
+    double current; // Smooth weighted round robin credit
+    uint64_t txPackets; // Packets sent on this wavelength
+    Time delay; // One-way propagation (+ FEC) delay
+    Time busyUntil; // When the bond's last packet on it finishes serialising (the bond is its only sender)
+    uint32_t rateClass; // Its RateClass for LOWEST_LATENCY
+    uint32_t classRank; // Its rank by delay in that class
+    int64_t heapKey; // Key of its live busy-heap entry (0: idle); older entries are stale
+  };
+
+  struct Flowlet
+  {
+    uint32_t slave; // Wavelength the flowlet is pinned to
+    Time lastSeen; // Last packet of the flow
+    bool used; // A flow has hashed to this slot
+  };
+
+  static const uint32_t FLOWLET_SLOTS = 4096; // Flowlet table size (power of two); flows may share a slot
+
+  typedef std::pair<int64_t, uint32_t> HeapEntry; // (busyUntil + delay in ticks, slave)
+
+  // LOWEST_LATENCY lookup structure for the wavelengths of one line rate. A packet costs the same
+  // serialisation time on all of them, so their order by delay (idle) and by busyUntil + delay
+  // (backlogged) holds for every packet size and the size is only added when classes are compared.
+  struct RateClass
+  {
+    DataRate rate; // Line rate shared by the class
+    std::vector<uint32_t> byDelay; // Rank by delay -> slave
+    std::vector<uint64_t> idleMask; // Bit per rank: wavelength has no backlog
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > busyHeap; // Backlogged wavelengths
+  };
+
+  bool ReceiveFromSlave (Ptr<NetDevice>, Ptr<const Packet> packet, uint16_t protocol, const Address &from)
+  {
+    Ptr<Packet> copy = packet->Copy ();
+    WdmSequenceTag tag;
+    if (!copy->RemovePacketTag (tag) || !m_resequence)
+      {
+        DeliverUp (copy, protocol, from);
+        return true;
+      }
+    m_resequencer.Receive (copy, tag.GetSeq (), protocol, from);
+    return true;
+  }
+
+  void DeliverUp (Ptr<Packet> packet, uint16_t protocol, const Address &from)
+  {
+    if (!m_promiscCallback.IsNull ())
+      {
+        m_promiscCallback (this, packet, protocol, from, m_address, NetDevice::PACKET_HOST);
+      }
+    m_rxCallback (this, packet, protocol, from);
+  }
+
+  void RefreshWeights ()
+  {
+    for (Slave &slave : m_slaves)
+      {
+        double per = slave.remoteErrorModel ? slave.remoteErrorModel->GetPacketErrorRate (m_mtu) : 0.0;
+        slave.weight = slave.rate.GetBitRate () * (1.0 - per);
+      }
+    m_weightsUpdated = Simulator::Now ();
+    m_weightsValid = true;
+  }
+
+  // Smooth weighted round robin (as in nginx): every wavelength earns its weight in credit, the richest
+  // one sends and pays the total. Over any window the shares match the weights, with no long runs.
+  uint32_t SelectWeighted ()
+  {
+    if (!m_weightsValid || Simulator::Now () - m_weightsUpdated >= m_weightRefresh)
+      {
+        RefreshWeights ();
+      }
+    double total = 0.0;
+    uint32_t best = 0;
+    for (uint32_t i = 0; i < m_slaves.size (); ++i)
+      {
+        Slave &slave = m_slaves[i];
+        slave.current += slave.weight;
+        total += slave.weight;
+        if (slave.current > m_slaves[best].current)
+          {
+            best = i;
+          }
+      }
+    m_slaves[best].current -= total;
+    return best;
+  }
+
+  // Groups the wavelengths by line rate for LOWEST_LATENCY (redone after a slave is added)
+  void BuildRateClasses ()
+  {
+    m_rateClasses.clear ();
+    for (uint32_t i = 0; i < m_slaves.size (); ++i)
+      {
+        uint32_t c = 0;
+        while (c < m_rateClasses.size () && m_rateClasses[c].rate.GetBitRate () != m_slaves[i].rate.GetBitRate ())
+          {
+            ++c;
+          }
+        if (c == m_rateClasses.size ())
+          {
+            m_rateClasses.push_back (RateClass ());
+            m_rateClasses.back ().rate = m_slaves[i].rate;
+          }
+        m_slaves[i].rateClass = c;
+        m_rateClasses[c].byDelay.push_back (i);
+      }
+    Time now = Simulator::Now ();
+    for (RateClass &rateClass : m_rateClasses)
+      {
+        std::stable_sort (rateClass.byDelay.begin (), rateClass.byDelay.end (),
+                          [this] (uint32_t a, uint32_t b) { return m_slaves[a].delay < m_slaves[b].delay; });
+        rateClass.idleMask.assign ((rateClass.byDelay.size () + 63) / 64, 0);
+        for (uint32_t r = 0; r < rateClass.byDelay.size (); ++r)
+          {
+            Slave &slave = m_slaves[rateClass.byDelay[r]];
+            slave.classRank = r;
+            slave.heapKey = 0;
+            if (slave.busyUntil <= now)
+              {
+                rateClass.idleMask[r / 64] |= 1ULL << (r % 64);
+              }
+            else
+              {
+                slave.heapKey = (slave.busyUntil + slave.delay).GetTimeStep ();
+                rateClass.busyHeap.push (HeapEntry (slave.heapKey, rateClass.byDelay[r]));
+              }
+          }
+      }
+    m_rateClassesValid = true;
+  }
+
+  // Idle wavelengths of a rate class are kept in a bitmask over their rank by delay, so the best one is
+  // the first set bit; backlogged ones sit in a min-heap keyed by busyUntil + delay. Only the chosen
+  // wavelength changes per packet, so a lookup is a find-first-set plus a heap top per rate class and
+  // the update one heap push, whatever the packet sizes in flight. Bonds usually have one or two line
+  // rates; with every rate distinct this degrades to the linear scan.
+  uint32_t SelectLowestLatency (uint32_t bytes)
+  {
+    if (!m_rateClassesValid)
+      {
+        BuildRateClasses ();
+      }
+    Time now = Simulator::Now ();
+    uint32_t best = 0;
+    int64_t bestDelivery = std::numeric_limits<int64_t>::max ();
+    for (RateClass &rateClass : m_rateClasses)
+      {
+        // Drop stale heap entries and move wavelengths whose backlog has drained to the idle set
+        while (!rateClass.busyHeap.empty ())
+          {
+            HeapEntry top = rateClass.busyHeap.top ();
+            Slave &slave = m_slaves[top.second];
+            if (top.first != slave.heapKey)
+              {
+                rateClass.busyHeap.pop ();
+              }
+            else if (slave.busyUntil <= now)
+              {
+                rateClass.idleMask[slave.classRank / 64] |= 1ULL << (slave.classRank % 64);
+                slave.heapKey = 0;
+                rateClass.busyHeap.pop ();
+              }
+            else
+              {
+                break;
+              }
+          }
+        int64_t txTime = rateClass.rate.CalculateBytesTxTime (bytes).GetTimeStep ();
+        for (uint32_t w = 0; w < rateClass.idleMask.size (); ++w)
+          {
+            if (rateClass.idleMask[w] != 0)
+              {
+                uint32_t idle = rateClass.byDelay[w * 64 + __builtin_ctzll (rateClass.idleMask[w])];
+                int64_t delivery = (now + m_slaves[idle].delay).GetTimeStep () + txTime;
+                if (delivery < bestDelivery)
+                  {
+                    best = idle;
+                    bestDelivery = delivery;
+                  }
+                break;
+              }
+          }
+        if (!rateClass.busyHeap.empty () && rateClass.busyHeap.top ().first + txTime < bestDelivery)
+          {
+            best = rateClass.busyHeap.top ().second;
+            bestDelivery = rateClass.busyHeap.top ().first + txTime;
+          }
+      }
+    return best;
+  }
+
+  // Updates the bond's view of the wavelength's transmit backlog after a send
+  void NoteSent (uint32_t slaveIndex, uint32_t bytes)
+  {
+    Slave &slave = m_slaves[slaveIndex];
+    Time now = Simulator::Now ();
+    slave.busyUntil = std::max (now, slave.busyUntil) + slave.rate.CalculateBytesTxTime (bytes);
+    if (m_policy == LOWEST_LATENCY && m_rateClassesValid)
+      {
+        RateClass &rateClass = m_rateClasses[slave.rateClass];
+        rateClass.idleMask[slave.classRank / 64] &= ~(1ULL << (slave.classRank % 64));
+        slave.heapKey = (slave.busyUntil + slave.delay).GetTimeStep ();
+        rateClass.busyHeap.push (HeapEntry (slave.heapKey, slaveIndex));
+        if (rateClass.busyHeap.size () > 2 * rateClass.byDelay.size ())
+          { // Mostly stale entries: keep one per backlogged wavelength (amortised O(1) per send)
+            std::vector<HeapEntry> live;
+            live.reserve (rateClass.byDelay.size ());
+            for (uint32_t member : rateClass.byDelay)
+              {
+                if (m_slaves[member].heapKey != 0)
+                  {
+                    live.push_back (HeapEntry (m_slaves[member].heapKey, member));
+                  }
+              }
+            rateClass.busyHeap = std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > (
+                std::greater<HeapEntry> (), std::move (live));
+          }
+      }
+  }
+
+  uint32_t SelectFlowlet (Ptr<const Packet> packet)
+  {
+    Time now = Simulator::Now ();
+    // Fixed table indexed by hash, as in switch flowlet tables: memory stays bounded however many
+    // flows come and go, and flows sharing a slot only share its wavelength choice
+    Flowlet &flowlet = m_flowlets[FlowHash (packet) & (FLOWLET_SLOTS - 1)];
+    if (!flowlet.used || now - flowlet.lastSeen >= m_flowletGap)
+      {
+        flowlet.slave = SelectWeighted (); // New flowlet: free to move to another wavelength
+        flowlet.used = true;
+      }
+    flowlet.lastSeen = now; // Inside the flowlet: stay on its wavelength to avoid reordering
+    return flowlet.slave;
+  }
+
+  // Hash of the IPv4 addresses, protocol and (for UDP/TCP) ports, read straight from the header bytes
+  static uint32_t FlowHash (Ptr<const Packet> packet)
+  {
+    uint8_t header[60 + 4];
+    uint32_t size = packet->CopyData (header, sizeof (header));
+    if (size < 20 || (header[0] >> 4) != 4)
+      {
+        return 0; // Not IPv4: one flow
+      }
+    uint32_t ihl = (header[0] & 0x0f) * 4u;
+    uint64_t key = 14695981039346656037ULL; // FNV-1a over src (12-15), dst (16-19) and protocol (9)
+    for (uint32_t i = 12; i < 20; ++i)
+      {
+        key = (key ^ header[i]) * 1099511628211ULL;
+      }
+    key = (key ^ header[9]) * 1099511628211ULL;
+    if ((header[9] == 6 || header[9] == 17) && size >= ihl + 4)
+      {
+        for (uint32_t i = ihl; i < ihl + 4; ++i)
+          {
+            key = (key ^ header[i]) * 1099511628211ULL; // Source and destination ports
+          }
+      }
+    return static_cast<uint32_t> (key ^ (key >> 32));
+  }
+
+  Ptr<Node> m_node; // Node this bond is installed on
+  Ptr<WdmLambdaChannel> m_channel; // View joining the two bonds
+  Mac48Address m_address; // MAC address
+  uint32_t m_ifIndex; // Interface index on the node
+  uint16_t m_mtu; // Smallest slave MTU
+  Policy m_policy; // Per packet or per flowlet
+  std::vector<Slave> m_slaves; // Bonded wavelengths
+  uint32_t m_txSeq; // Next sequence number to tag
+  bool m_rateClassesValid; // False until built, or after a slave is added
+  std::vector<RateClass> m_rateClasses; // LOWEST_LATENCY index, one per line rate
+  bool m_weightsValid; // False until the first refresh, or after a slave is added
+  Time m_weightsUpdated; // When the weights were last computed
+  Time m_weightRefresh; // How long weights are reused
+  Time m_flowletGap; // Flowlet idle timeout
+  std::vector<Flowlet> m_flowlets; // Flow hash slot -> current flowlet
+  bool m_resequence; // Reorder received packets
+  uint32_t m_resequenceWindow; // Reorder buffer size
+  Time m_resequenceTimeout; // Hole timeout
+  WdmResequencer m_resequencer; // Receive-side reorder buffer
+  NetDevice::ReceiveCallback m_rxCallback; // Up the stack
+  NetDevice::PromiscReceiveCallback m_promiscCallback; // Promiscuous sniffers
+  TracedCallback<> m_linkChangeCallbacks; // Link state listeners
+};
+
+// ------------------ ROADM Topology ------------------
+// Resident set size of this process in bytes (Linux), for build-cost reports
+uint64_t
+ResidentBytes ()
+{
+  std::ifstream statm ("/proc/self/statm");
+  uint64_t sizePages = 0;
+  uint64_t residentPages = 0;
+  statm >> sizePages >> residentPages;
+  return residentPages * static_cast<uint64_t> (sysconf (_SC_PAGESIZE));
+}
+
+class RoadmTopology
+{ // Rings and meshes of ROADM nodes joined by fiber spans, each span a WdmFiberChannel carrying the same
+  // N wavelengths. Devices are created and attached directly (no helper, container or attribute lookup
+  // per link), and every span has a single OpticalErrorModel shared by all its wavelength receivers.
+public:
+  enum Shape
+  {
+    RING, // Node i to node i+1, closing the loop
+    MESH  // Grid of ceil(sqrt(n)) columns, each node to its right and lower neighbour
+  };
+
+  struct Config
+  {
+    Shape shape;
+    uint32_t nodes; // ROADM count
+    uint32_t wavelengthsPerFiber; // Lambdas on every span
+    DataRate rate; // Line rate of every lambda
+    Time spanDelay; // Propagation delay of one span
+    double spanBer; // Pre-FEC BER of one span
+    std::vector<DataRate> lambdaRates; // Lambda i runs at entry i % size instead (empty: rate)
+    std::vector<Time> lambdaDelays; // Span delay of lambda i is entry i % size instead (empty: spanDelay)
+    bool createDevices; // False: only the graph (for studies that never send packets)
+  };
+
+  struct Span
+  {
+    uint32_t a; // Node at one end
+    uint32_t b; // Node at the other end
+    Ptr<WdmFiberChannel> fiber; // Null without devices
+    Ptr<OpticalErrorModel> errorModel; // Shared by the receivers of all lambdas of the span
+  };
+
+  struct BuildReport
+  {
+    double seconds; // Wall time of Build
+    uint64_t bytes; // Resident memory added by Build
+    uint32_t devices; // WdmNetDevices created
+  };
+
+  // Adjacent (node, span) pairs of each node
+  typedef std::vector<std::vector<std::pair<uint32_t, uint32_t> > > Adjacency;
+
+  explicit RoadmTopology (const Config &config)
+    : m_config (config)
+  {
+    m_report = BuildReport ();
+  }
+
+  void Build ()
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    uint64_t bytesBefore = ResidentBytes ();
+
+    uint32_t n = m_config.nodes;
+    m_nodes.Create (n);
+    m_adjacency.assign (n, std::vector<std::pair<uint32_t, uint32_t> > ());
+    if (m_config.shape == RING)
+      {
+        m_spans.reserve (n);
+        for (uint32_t i = 0; i < n && n > 1; ++i)
+          {
+            if (n == 2 && i == 1)
+              {
+                break; // Two nodes: one span, not two parallel ones
+              }
+            AddSpan (i, (i + 1) % n);
+          }
+      }
+    else
+      {
+        uint32_t cols = static_cast<uint32_t> (std::ceil (std::sqrt (static_cast<double> (n))));
+        m_spans.reserve (2 * n);
+        for (uint32_t i = 0; i < n; ++i)
+          {
+            if ((i + 1) % cols != 0 && i + 1 < n)
+              {
+                AddSpan (i, i + 1);
+              }
+            if (i + cols < n)
+              {
+                AddSpan (i, i + cols);
+              }
+          }
+      }
+
+    m_report.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    uint64_t bytesAfter = ResidentBytes ();
+    m_report.bytes = bytesAfter > bytesBefore ? bytesAfter - bytesBefore : 0;
+  }
+
+  const Config &GetConfig () const { return m_config; }
+  NodeContainer GetNodes () const { return m_nodes; }
+  Ptr<Node> GetNode (uint32_t i) const { return m_nodes.Get (i); }
+  uint32_t GetNNodes () const { return m_config.nodes; }
+  uint32_t GetNSpans () const { return static_cast<uint32_t> (m_spans.size ()); }
+  const Span &GetSpan (uint32_t i) const { return m_spans[i]; }
+  const Adjacency &GetAdjacency () const { return m_adjacency; }
+  const BuildReport &GetReport () const { return m_report; }
+
+private:
+  void AddSpan (uint32_t a, uint32_t b)
+  {
+    uint32_t index = static_cast<uint32_t> (m_spans.size ());
+    Span span;
+    span.a = a;
+    span.b = b;
+    if (m_config.createDevices)
+      {
+        span.fiber = CreateObject<WdmFiberChannel> ();
+        span.errorModel = CreateObject<OpticalErrorModel> ();
+        span.errorModel->SetBer (m_config.spanBer);
+        span.errorModel->SetWavelengthId (index); // Distinct random stream per span
+        Ptr<Node> nodeA = m_nodes.Get (a);
+        Ptr<Node> nodeB = m_nodes.Get (b);
+        for (uint32_t lambda = 0; lambda < m_config.wavelengthsPerFiber; ++lambda)
+          {
+            DataRate rate = m_config.lambdaRates.empty () ? m_config.rate
+                                                          : m_config.lambdaRates[lambda % m_config.lambdaRates.size ()];
+            Time delay = m_config.lambdaDelays.empty () ? m_config.spanDelay
+                                                        : m_config.lambdaDelays[lambda % m_config.lambdaDelays.size ()];
+            Ptr<WdmNetDevice> devA = CreateDevice (nodeA, rate, span.errorModel);
+            Ptr<WdmNetDevice> devB = CreateDevice (nodeB, rate, span.errorModel);
+            span.fiber->AddWavelength (devA, devB, delay);
+          }
+        m_report.devices += 2 * m_config.wavelengthsPerFiber;
+      }
+    m_spans.push_back (span);
+    m_adjacency[a].push_back (std::make_pair (b, index));
+    m_adjacency[b].push_back (std::make_pair (a, index));
+  }
+
+  Ptr<WdmNetDevice> CreateDevice (Ptr<Node> node, DataRate rate, Ptr<OpticalErrorModel> errorModel)
+  {
+    Ptr<WdmNetDevice> dev = CreateObject<WdmNetDevice> ();
+    dev->SetAddress (Mac48Address::Allocate ());
+    dev->SetDataRate (rate);
+    dev->SetReceiveErrorModel (errorModel);
+    node->AddDevice (dev);
+    return dev;
+  }
+
+  Config m_config; // What to build
+  NodeContainer m_nodes; // ROADMs
+  std::vector<Span> m_spans; // Fiber spans
+  Adjacency m_adjacency; // Node -> (neighbour, span)
+  BuildReport m_report; // Build cost
+};
+
+// ------------------ Routing and Wavelength Assignment ------------------
+class SpectrumOccupancy
+{ // Which wavelengths (fixed grid) or 12.5 GHz slots (flexgrid) are lit on each span, one bit per unit
+  // packed 64 to a word, spans stored back to back. The units free on every span of a path (the
+  // continuity constraint) are the AND of the inverted span words, one word-wide operation per 64 units
+  // per hop.
+public:
+  SpectrumOccupancy ()
+    : m_units (0),
+      m_words (0)
+  {
+  }
+
+  void Reset (uint32_t spans, uint32_t units)
+  {
+    m_units = units;
+    m_words = (units + 63) / 64;
+    m_bits.assign (static_cast<size_t> (spans) * m_words, 0);
+    m_useCount.assign (units, 0);
+    m_tailMask = units % 64 == 0 ? ~0ULL : (1ULL << (units % 64)) - 1;
+  }
+
+  uint32_t GetUnits () const { return m_units; }
+  uint32_t GetWords () const { return m_words; }
+  const uint64_t *GetSpanWords (uint32_t span) const { return &m_bits[static_cast<size_t> (span) * m_words]; }
+  bool IsUsed (uint32_t span, uint32_t unit) const { return (GetSpanWords (span)[unit / 64] >> (unit % 64)) & 1; }
+  uint32_t GetUseCount (uint32_t unit) const { return m_useCount[unit]; } // Spans the unit is lit on
+
+  // Writes into free (GetWords () words) the units unused on every span of the path
+  void FreeOnPath (const std::vector<uint32_t> &spans, uint64_t *free) const
+  {
+    for (uint32_t w = 0; w < m_words; ++w)
+      {
+        free[w] = ~0ULL;
+      }
+    free[m_words - 1] = m_tailMask;
+    for (uint32_t span : spans)
+      {
+        const uint64_t *used = GetSpanWords (span);
+        for (uint32_t w = 0; w < m_words; ++w)
+          {
+            free[w] &= ~used[w];
+          }
+      }
+  }
+
+  // Lights units [first, first + width) on every span of the path
+  void Occupy (const std::vector<uint32_t> &spans, uint32_t first, uint32_t width)
+  {
+    for (uint32_t unit = first; unit < first + width; ++unit)
+      {
+        for (uint32_t span : spans)
+          {
+            m_bits[static_cast<size_t> (span) * m_words + unit / 64] |= 1ULL << (unit % 64);
+          }
+        m_useCount[unit] += static_cast<uint32_t> (spans.size ());
+      }
+  }
+
+  void Release (const std::vector<uint32_t> &spans, uint32_t first, uint32_t width)
+  {
+    for (uint32_t unit = first; unit < first + width; ++unit)
+      {
+        for (uint32_t span : spans)
+          {
+            m_bits[static_cast<size_t> (span) * m_words + unit / 64] &= ~(1ULL << (unit % 64));
+          }
+        m_useCount[unit] -= static_cast<uint32_t> (spans.size ());
+      }
+  }
+
+  // Lowest unit starting a run of width free units in free (words long), or words * 64 if none. Run
+  // starts are found with shift-and: after free &= free >> k the bit i says units i..i+2k-1 are free,
+  // so doubling k needs log2 (width) multi-word shifts instead of a walk over every unit.
+  static uint32_t FirstFreeBlock (uint64_t *free, uint32_t words, uint32_t width)
+  {
+    uint32_t covered = 1; // Each set bit currently stands for a free run of this length
+    while (covered < width)
+      {
+        uint32_t shift = std::min (covered, width - covered);
+        ShiftRightAnd (free, words, shift);
+        covered += shift;
+      }
+    for (uint32_t w = 0; w < words; ++w)
+      {
+        if (free[w] != 0)
+          {
+            return w * 64 + __builtin_ctzll (free[w]);
+          }
+      }
+    return words * 64;
+  }
+
+private:
+  // bits &= bits >> shift over a little-endian multi-word bitmap (bits past the end count as zero)
+  static void ShiftRightAnd (uint64_t *bits, uint32_t words, uint32_t shift)
+  {
+    uint32_t wordShift = shift / 64;
+    uint32_t bitShift = shift % 64;
+    for (uint32_t w = 0; w < words; ++w)
+      { // Ascending: word w only reads words above it, which are still unmodified
+        uint64_t lo = w + wordShift < words ? bits[w + wordShift] : 0;
+        uint64_t hi = w + wordShift + 1 < words ? bits[w + wordShift + 1] : 0;
+        uint64_t shifted = bitShift == 0 ? lo : (lo >> bitShift) | (hi << (64 - bitShift));
+        bits[w] &= shifted;
+      }
+  }
+
+  uint32_t m_units; // Wavelengths per span
+  uint32_t m_words; // 64-bit words per span
+  uint64_t m_tailMask; // Valid bits of the last word
+  std::vector<uint64_t> m_bits; // Span-major occupancy bitsets
+  std::vector<uint32_t> m_useCount; // Per wavelength: spans it is lit on (for most-used assignment)
+};
+
+// Flexgrid slots for a lightpath of the given rate: symbol rate with 10% FEC overhead and 10% roll-off,
+// rounded up to 12.5 GHz slots, plus one guard slot
+uint32_t
+FlexgridSlots (DataRate rate, ModulationFormat format)
+{
+  const double slotHz = 12.5e9;
+  double bitsPerSymbol = format == OOK ? 1.0 : format == DP_QPSK ? 4.0 : 8.0; // Both polarisations
+  double bandwidthHz = rate.GetBitRate () * 1.1 / bitsPerSymbol * 1.1;
+  return static_cast<uint32_t> (std::ceil (bandwidthHz / slotHz)) + 1;
+}
+
+class RwaEngine
+{ // Routes lightpaths over a RoadmTopology and picks a wavelength that is free on every hop. Routing
+  // is fixed-alternate: the k shortest paths (by hop count, Yen's algorithm) of a node pair are found on
+  // first use and cached; each request tries them in order. Assignment is first-fit (lowest free
+  // wavelength) or most-used (the free wavelength lit on the most spans network-wide, which packs
+  // the spectrum and keeps long continuous runs free). A flexgrid lightpath asks for several contiguous
+  // slots and always gets the lowest free block (first-fit).
+public:
+  enum Assignment
+  {
+    FIRST_FIT,
+    MOST_USED
+  };
+
+  struct Path
+  {
+    std::vector<uint32_t> nodes; // Source to destination
+    std::vector<uint32_t> spans; // nodes.size () - 1 spans
+  };
+
+  struct Lightpath
+  {
+    std::vector<uint32_t> spans; // Route
+    uint32_t lambda; // Wavelength (or first slot) on every span of the route
+    uint32_t width; // Units occupied: 1 on a fixed grid, the slot count on flexgrid
+  };
+
+  struct Stats
+  {
+    uint64_t requests; // Setup attempts
+    uint64_t blocked; // Attempts with no path/wavelength
+  };
+
+  RwaEngine (const RoadmTopology &topology, uint32_t k, Assignment assignment)
+    : m_topology (topology),
+      m_k (std::max (k, 1u)),
+      m_assignment (assignment)
+  {
+    m_occupancy.Reset (topology.GetNSpans (), topology.GetConfig ().wavelengthsPerFiber);
+    m_free.resize (m_occupancy.GetWords ());
+    m_stamp.assign (topology.GetNNodes (), 0);
+    m_parent.resize (topology.GetNNodes ());
+    m_blockedNode.assign (topology.GetNNodes (), 0);
+    m_blockedSpan.assign (topology.GetNSpans (), 0);
+    m_visitEpoch = 0;
+    m_epoch = 0;
+    m_stats = Stats ();
+  }
+
+  // Finds a route and width contiguous units for src -> dst and occupies them; false if blocked
+  bool Setup (uint32_t src, uint32_t dst, uint32_t width, Lightpath &lightpath)
+  {
+    ++m_stats.requests;
+    const std::vector<Path> &paths = GetPaths (src, dst);
+    for (const Path &path : paths)
+      {
+        m_occupancy.FreeOnPath (path.spans, &m_free[0]);
+        uint32_t lambda = width == 1 ? SelectWavelength ()
+                                     : SpectrumOccupancy::FirstFreeBlock (&m_free[0], m_occupancy.GetWords (), width);
+        if (lambda < m_occupancy.GetUnits ())
+          {
+            m_occupancy.Occupy (path.spans, lambda, width);
+            lightpath.spans = path.spans;
+            lightpath.lambda = lambda;
+            lightpath.width = width;
+            return true;
+          }
+      }
+    ++m_stats.blocked;
+    return false;
+  }
+
+  void Release (const Lightpath &lightpath) { m_occupancy.Release (lightpath.spans, lightpath.lambda, lightpath.width); }
+
+  const std::vector<Path> &GetPaths (uint32_t src, uint32_t dst)
+  {
+    uint64_t key = (static_cast<uint64_t> (src) << 32) | dst;
+    std::unordered_map<uint64_t, std::vector<Path> >::iterator it = m_paths.find (key);
+    if (it == m_paths.end ())
+      {
+        it = m_paths.insert (std::make_pair (key, KShortestPaths (src, dst))).first;
+      }
+    return it->second;
+  }
+
+  const SpectrumOccupancy &GetOccupancy () const { return m_occupancy; }
+  const Stats &GetStats () const { return m_stats; }
+
+  static const uint32_t NO_WAVELENGTH = 0xffffffff;
+
+private:
+  uint32_t SelectWavelength () const
+  {
+    uint32_t best = NO_WAVELENGTH;
+    for (uint32_t w = 0; w < m_free.size (); ++w)
+      {
+        uint64_t word = m_free[w];
+        if (m_assignment == FIRST_FIT && word != 0)
+          {
+            return w * 64 + __builtin_ctzll (word);
+          }
+        while (word != 0)
+          { // Most-used: visit each free wavelength
+            uint32_t lambda = w * 64 + __builtin_ctzll (word);
+            word &= word - 1;
+            if (best == NO_WAVELENGTH || m_occupancy.GetUseCount (lambda) > m_occupancy.GetUseCount (best))
+              {
+                best = lambda;
+              }
+          }
+      }
+    return best;
+  }
+
+  // Breadth-first shortest path avoiding the nodes/spans marked with the current epoch
+  bool ShortestPath (uint32_t src, uint32_t dst, Path &path)
+  {
+    const RoadmTopology::Adjacency &adjacency = m_topology.GetAdjacency ();
+    ++m_visitEpoch;
+    if (m_visitEpoch == 0)
+      { // Wrapped: clear the stamps
+        std::fill (m_stamp.begin (), m_stamp.end (), 0);
+        m_visitEpoch = 1;
+      }
+    m_queue.clear ();
+    m_queue.push_back (src);
+    m_stamp[src] = m_visitEpoch;
+    for (size_t head = 0; head < m_queue.size (); ++head)
+      {
+        uint32_t node = m_queue[head];
+        if (node == dst)
+          {
+            path.nodes.clear ();
+            path.spans.clear ();
+            for (uint32_t n = dst; n != src; n = m_parent[n].first)
+              {
+                path.nodes.push_back (n);
+                path.spans.push_back (m_parent[n].second);
+              }
+            path.nodes.push_back (src);
+            std::reverse (path.nodes.begin (), path.nodes.end ());
+            std::reverse (path.spans.begin (), path.spans.end ());
+            return true;
+          }
+        for (const std::pair<uint32_t, uint32_t> &edge : adjacency[node])
+          {
+            if (m_stamp[edge.first] == m_visitEpoch || m_blockedNode[edge.first] == m_epoch
+                || m_blockedSpan[edge.second] == m_epoch)
+              {
+                continue;
+              }
+            m_stamp[edge.first] = m_visitEpoch;
+            m_parent[edge.first] = std::make_pair (node, edge.second);
+            m_queue.push_back (edge.first);
+          }
+      }
+    return false;
+  }
+
+  // Yen's k shortest loopless paths
+  std::vector<Path> KShortestPaths (uint32_t src, uint32_t dst)
+  {
+    std::vector<Path> accepted;
+    std::vector<Path> candidates;
+    Path first;
+    ++m_epoch; // Nothing blocked
+    if (src == dst || !ShortestPath (src, dst, first))
+      {
+        return accepted;
+      }
+    accepted.push_back (first);
+    while (accepted.size () < m_k)
+      {
+        const Path previous = accepted.back ();
+        for (uint32_t i = 0; i + 1 < previous.nodes.size (); ++i)
+          {
+            ++m_epoch;
+            uint32_t spur = previous.nodes[i];
+            for (const Path &path : accepted)
+              { // Do not leave the shared root the way an accepted path already did
+                if (path.nodes.size () > i + 1 && std::equal (previous.nodes.begin (), previous.nodes.begin () + i + 1,
+                                                               path.nodes.begin ()))
+                  {
+                    m_blockedSpan[path.spans[i]] = m_epoch;
+                  }
+              }
+            for (uint32_t j = 0; j < i; ++j)
+              {
+                m_blockedNode[previous.nodes[j]] = m_epoch; // Keep the path loopless
+              }
+            Path spurPath;
+            if (!ShortestPath (spur, dst, spurPath))
+              {
+                continue;
+              }
+            Path total;
+            total.nodes.assign (previous.nodes.begin (), previous.nodes.begin () + i);
+            total.nodes.insert (total.nodes.end (), spurPath.nodes.begin (), spurPath.nodes.end ());
+            total.spans.assign (previous.spans.begin (), previous.spans.begin () + i);
+            total.spans.insert (total.spans.end (), spurPath.spans.begin (), spurPath.spans.end ());
+            bool known = false;
+            for (const Path &path : candidates)
+              {
+                known = known || path.spans == total.spans;
+              }
+            for (const Path &path : accepted)
+              {
+                known = known || path.spans == total.spans;
+              }
+            if (!known)
+              {
+                candidates.push_back (total);
+              }
+          }
+        if (candidates.empty ())
+          {
+            break;
+          }
+        std::vector<Path>::iterator shortest = std::min_element (candidates.begin (), candidates.end (),
+            [] (const Path &a, const Path &b) { return a.spans.size () < b.spans.size (); });
+        accepted.push_back (*shortest);
+        candidates.erase (shortest);
+      }
+    return accepted;
+  }
+
+  const RoadmTopology &m_topology; // Graph being routed over
+  uint32_t m_k; // Alternate paths per node pair
+  Assignment m_assignment; // Wavelength choice
+  SpectrumOccupancy m_occupancy; // Lit wavelengths per span
+  std::vector<uint64_t> m_free; // Scratch: wavelengths free along the current path
+  std::unordered_map<uint64_t, std::vector<Path> > m_paths; // (src, dst) -> k shortest paths
+  std::vector<uint32_t> m_stamp; // BFS visited marks
+  uint32_t m_visitEpoch; // Current BFS mark
+  std::vector<std::pair<uint32_t, uint32_t> > m_parent; // BFS tree: node -> (parent, span)
+  std::vector<uint32_t> m_queue; // BFS queue
+  std::vector<uint32_t> m_blockedNode; // Yen: node excluded when equal to m_epoch
+  std::vector<uint32_t> m_blockedSpan; // Yen: span excluded when equal to m_epoch
+  uint32_t m_epoch; // Current Yen exclusion mark
+  Stats m_stats; // Setup attempts and blocking
+};
+
+// ------------------ GN-Model NLI Kernel ------------------
+struct GnSpanConstants
+{ // Per-span constants of the incoherent GN model (rectangular spectra, closed-form asinh integral).
+  // The NLI power on channel i is P_NLI,i = scale * G_i * B_i * sum_j G_j^2 * psi (f_j - f_i, B_j) with
+  // G = P / B the signal PSD; the j = i term of the same formula is the SPM contribution.
+  double scale; // 16/27 gamma^2 Leff^2
+  double a; // pi^2 |beta2| Leff,a
+  double invDenominator; // 1 / (4 pi |beta2| Leff,a)
+
+  static GnSpanConstants From (double lengthKm, double alphaDbPerKm, double gammaPerWattKm, double beta2Ps2PerKm)
+  {
+    double alpha = alphaDbPerKm * std::log (10.0) / 10.0 / 1e3; // Power attenuation, 1/m
+    double length = lengthKm * 1e3;
+    double lEff = (1.0 - std::exp (-alpha * length)) / alpha;
+    double lEffA = 1.0 / alpha; // Asymptotic effective length
+    double gamma = gammaPerWattKm / 1e3;
+    double beta2 = std::fabs (beta2Ps2PerKm) * 1e-27; // s^2/m
+    GnSpanConstants c;
+    c.scale = 16.0 / 27.0 * gamma * gamma * lEff * lEff;
+    c.a = M_PI * M_PI * beta2 * lEffA;
+    c.invDenominator = 1.0 / (4.0 * M_PI * beta2 * lEffA);
+    return c;
+  }
+
+  // Interaction integral of a channel of bandwidth b at offset df
+  double Psi (double df, double b) const
+  {
+    return (std::asinh (a * b * (df + 0.5 * b)) - std::asinh (a * b * (df - 0.5 * b))) * invDenominator;
+  }
+};
+
+struct GnChannels
+{ // Channels of one span as struct-of-arrays, so the NLI sum streams three contiguous arrays
+  std::vector<double> frequencyHz; // Centre frequency
+  std::vector<double> powerW; // Launch power
+  std::vector<double> bandwidthHz; // Occupied bandwidth (symbol rate)
+
+  void Resize (uint32_t n)
+  {
+    frequencyHz.resize (n);
+    powerW.resize (n);
+    bandwidthHz.resize (n);
+  }
+  uint32_t Size () const { return static_cast<uint32_t> (frequencyHz.size ()); }
+};
+
+// Reference kernel: NLI power (W) on every channel, std::asinh, one channel pair at a time
+void
+GnNliScalar (const GnSpanConstants &c, const GnChannels &ch, double *nli)
+{
+  uint32_t n = ch.Size ();
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      double sum = 0.0;
+      for (uint32_t j = 0; j < n; ++j)
+        {
+          double g = ch.powerW[j] / ch.bandwidthHz[j];
+          sum += g * g * c.Psi (ch.frequencyHz[j] - ch.frequencyHz[i], ch.bandwidthHz[j]);
+        }
+      nli[i] = c.scale * ch.powerW[i] * sum; // G_i * B_i = P_i
+    }
+}
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+// Vector asinh (x) = sign (x) ln (|x| + sqrt (x^2 + 1)); ln via exponent/mantissa split, the mantissa
+// brought into [sqrt(1/2), sqrt(2)) and ln m = 2 atanh (s), s = (m-1)/(m+1), |s| < 0.172, to s^17
+// (about 1e-15 relative; the argument of ln is >= 1 here)
+#if defined(__AVX512F__)
+typedef __m512d GnVec;
+static const uint32_t GN_LANES = 8;
+static inline GnVec GnSet1 (double x) { return _mm512_set1_pd (x); }
+static inline GnVec GnLoad (const double *p) { return _mm512_loadu_pd (p); }
+static inline GnVec GnAdd (GnVec x, GnVec y) { return _mm512_add_pd (x, y); }
+static inline GnVec GnSub (GnVec x, GnVec y) { return _mm512_sub_pd (x, y); }
+static inline GnVec GnMul (GnVec x, GnVec y) { return _mm512_mul_pd (x, y); }
+static inline GnVec GnDiv (GnVec x, GnVec y) { return _mm512_div_pd (x, y); }
+static inline GnVec GnFma (GnVec x, GnVec y, GnVec z) { return _mm512_fmadd_pd (x, y, z); }
+static inline GnVec GnSqrt (GnVec x) { return _mm512_sqrt_pd (x); }
+static inline GnVec GnAbs (GnVec x) { return _mm512_abs_pd (x); }
+static inline double GnSum (GnVec x) { return _mm512_reduce_add_pd (x); }
+static inline GnVec GnCopySign (GnVec magnitude, GnVec sign)
+{
+  __m512i signBit = _mm512_set1_epi64 (static_cast<long long> (0x8000000000000000ULL));
+  return _mm512_castsi512_pd (_mm512_or_si512 (_mm512_castpd_si512 (magnitude),
+                                               _mm512_and_si512 (_mm512_castpd_si512 (sign), signBit)));
+}
+static inline void GnSplit (GnVec x, GnVec &exponent, GnVec &mantissa)
+{ // x = 2^exponent * mantissa, mantissa in [sqrt(1/2), sqrt(2))
+  exponent = _mm512_getexp_pd (x);
+  mantissa = _mm512_getmant_pd (x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero); // [1, 2)
+  __mmask8 big = _mm512_cmp_pd_mask (mantissa, _mm512_set1_pd (M_SQRT2), _CMP_GT_OQ);
+  mantissa = _mm512_mask_mul_pd (mantissa, big, mantissa, _mm512_set1_pd (0.5));
+  exponent = _mm512_mask_add_pd (exponent, big, exponent, _mm512_set1_pd (1.0));
+}
+#else
+typedef __m256d GnVec;
+static const uint32_t GN_LANES = 4;
+static inline GnVec GnSet1 (double x) { return _mm256_set1_pd (x); }
+static inline GnVec GnLoad (const double *p) { return _mm256_loadu_pd (p); }
+static inline GnVec GnAdd (GnVec x, GnVec y) { return _mm256_add_pd (x, y); }
+static inline GnVec GnSub (GnVec x, GnVec y) { return _mm256_sub_pd (x, y); }
+static inline GnVec GnMul (GnVec x, GnVec y) { return _mm256_mul_pd (x, y); }
+static inline GnVec GnDiv (GnVec x, GnVec y) { return _mm256_div_pd (x, y); }
+#if defined(__FMA__)
+static inline GnVec GnFma (GnVec x, GnVec y, GnVec z) { return _mm256_fmadd_pd (x, y, z); }
+#else
+static inline GnVec GnFma (GnVec x, GnVec y, GnVec z) { return _mm256_add_pd (_mm256_mul_pd (x, y), z); }
+#endif
+static inline GnVec GnSqrt (GnVec x) { return _mm256_sqrt_pd (x); }
+static inline GnVec GnAbs (GnVec x) { return _mm256_andnot_pd (_mm256_set1_pd (-0.0), x); }
+static inline double GnSum (GnVec x)
+{
+  __m128d pair = _mm_add_pd (_mm256_castpd256_pd128 (x), _mm256_extractf128_pd (x, 1));
+  return _mm_cvtsd_f64 (_mm_add_sd (pair, _mm_unpackhi_pd (pair, pair)));
+}
+static inline GnVec GnCopySign (GnVec magnitude, GnVec sign)
+{
+  return _mm256_or_pd (magnitude, _mm256_and_pd (sign, _mm256_set1_pd (-0.0)));
+}
+static inline void GnSplit (GnVec x, GnVec &exponent, GnVec &mantissa)
+{ // x = 2^exponent * mantissa, mantissa in [sqrt(1/2), sqrt(2)); x is positive and normal
+  __m256i bits = _mm256_castpd_si256 (x);
+  __m256i biased = _mm256_srli_epi64 (bits, 52);
+  // int64 -> double without AVX-512DQ: put the integer in the mantissa of 2^52 and subtract 2^52
+  __m256d magic = _mm256_castsi256_pd (_mm256_set1_epi64x (0x4330000000000000LL));
+  exponent = _mm256_sub_pd (_mm256_castsi256_pd (_mm256_or_si256 (biased, _mm256_castpd_si256 (magic))), magic);
+  exponent = _mm256_sub_pd (exponent, _mm256_set1_pd (1023.0));
+  __m256i mantissaBits = _mm256_or_si256 (_mm256_and_si256 (bits, _mm256_set1_epi64x (0x000FFFFFFFFFFFFFLL)),
+                                          _mm256_set1_epi64x (0x3FF0000000000000LL)); // [1, 2)
+  mantissa = _mm256_castsi256_pd (mantissaBits);
+  __m256d big = _mm256_cmp_pd (mantissa, _mm256_set1_pd (M_SQRT2), _CMP_GT_OQ);
+  mantissa = _mm256_blendv_pd (mantissa, _mm256_mul_pd (mantissa, _mm256_set1_pd (0.5)), big);
+  exponent = _mm256_add_pd (exponent, _mm256_and_pd (big, _mm256_set1_pd (1.0)));
+}
+#endif
+
+static inline GnVec
+GnAsinh (GnVec x)
+{
+  GnVec ax = GnAbs (x);
+  GnVec arg = GnAdd (ax, GnSqrt (GnFma (ax, ax, GnSet1 (1.0))));
+  GnVec exponent;
+  GnVec mantissa;
+  GnSplit (arg, exponent, mantissa);
+  GnVec s = GnDiv (GnSub (mantissa, GnSet1 (1.0)), GnAdd (mantissa, GnSet1 (1.0)));
+  GnVec s2 = GnMul (s, s);
+  GnVec poly = GnSet1 (1.0 / 17.0);
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 15.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 13.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 11.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 9.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 7.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 5.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0 / 3.0));
+  poly = GnFma (poly, s2, GnSet1 (1.0));
+  GnVec ln = GnFma (exponent, GnSet1 (M_LN2), GnMul (GnSet1 (2.0), GnMul (s, poly)));
+  return GnCopySign (ln, x);
+}
+#endif
+
+// Same result as GnNliScalar, with the sum over j GN_LANES channels at a time (AVX-512 or AVX2 when
+// compiled for them, otherwise the scalar kernel)
+void
+GnNliVector (const GnSpanConstants &c, const GnChannels &ch, double *nli)
+{
+#if defined(__AVX512F__) || defined(__AVX2__)
+  uint32_t n = ch.Size ();
+  uint32_t body = n - n % GN_LANES;
+  GnVec a = GnSet1 (c.a);
+  GnVec half = GnSet1 (0.5);
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      GnVec fi = GnSet1 (ch.frequencyHz[i]);
+      GnVec acc = GnSet1 (0.0);
+      for (uint32_t j = 0; j < body; j += GN_LANES)
+        {
+          GnVec b = GnLoad (&ch.bandwidthHz[j]);
+          GnVec g = GnDiv (GnLoad (&ch.powerW[j]), b);
+          GnVec df = GnSub (GnLoad (&ch.frequencyHz[j]), fi);
+          GnVec ab = GnMul (a, b);
+          GnVec halfB = GnMul (half, b);
+          GnVec psi = GnSub (GnAsinh (GnMul (ab, GnAdd (df, halfB))), GnAsinh (GnMul (ab, GnSub (df, halfB))));
+          acc = GnFma (GnMul (g, g), psi, acc);
+        }
+      double sum = GnSum (acc) * c.invDenominator;
+      for (uint32_t j = body; j < n; ++j)
+        {
+          double g = ch.powerW[j] / ch.bandwidthHz[j];
+          sum += g * g * c.Psi (ch.frequencyHz[j] - ch.frequencyHz[i], ch.bandwidthHz[j]);
+        }
+      nli[i] = c.scale * ch.powerW[i] * sum;
+    }
+#else
+  GnNliScalar (c, ch, nli);
+#endif
+}
+
+// ------------------ Quality of Transmission (GN Model) ------------------
+class QotEngine
+{ // Per-lightpath SNR from the incoherent GN model over identical amplified spans on a fixed grid:
+  // 1/SNR is the sum over the path's spans of ASE/P plus NLI/P, and on one span the NLI on channel i
+  // is a sum over every lit channel j of a weight that only depends on |i - j|. So instead of
+  // recomputing all channel pairs when a lightpath comes or goes, each of its spans keeps the NLI/P
+  // every channel would see (m_nli), adjusted by one weight per channel (O(N) per span), and each
+  // lightpath on those spans moves by a single weight. Only lightpaths sharing a span with the change
+  // are touched, and their OpticalErrorModels get the new SNR once per change. Running sums pick up
+  // rounding, so a span's NLI is rebuilt exactly every RESYNC_INTERVAL changes (or reset when it empties)
+  // and a lightpath's total is re-summed from its spans after as many incremental updates.
+public:
+  struct SpanParameters
+  {
+    double lengthKm; // Span length
+    double alphaDbPerKm; // Fiber attenuation
+    double gammaPerWattKm; // Nonlinear coefficient
+    double beta2Ps2PerKm; // Group-velocity dispersion (|beta2| is used)
+    double noiseFigureDb; // EDFA noise figure (gain = span loss)
+    double launchPowerDbm; // Per-channel launch power
+    double spacingHz; // Grid spacing
+    double symbolRateHz; // Channel bandwidth
+    double centreFrequencyHz; // For the photon energy in the ASE term
+
+    static SpanParameters Default ()
+    {
+      SpanParameters p;
+      p.lengthKm = 80.0;
+      p.alphaDbPerKm = 0.2;
+      p.gammaPerWattKm = 1.3;
+      p.beta2Ps2PerKm = -21.7;
+      p.noiseFigureDb = 5.0;
+      p.launchPowerDbm = 0.0;
+      p.spacingHz = 50e9;
+      p.symbolRateHz = 32e9;
+      p.centreFrequencyHz = 193.4e12;
+      return p;
+    }
+  };
+
+  QotEngine (uint32_t spans, uint32_t channels, const SpanParameters &parameters)
+    : m_channels (channels),
+      m_parameters (parameters),
+      m_channelUpdates (0)
+  {
+    m_nli.assign (static_cast<size_t> (spans) * channels, 0.0);
+    m_spanLightpaths.resize (spans);
+    m_spanChanges.assign (spans, 0);
+    ComputeWeights ();
+  }
+
+  static const uint32_t NO_LIGHTPATH = 0xffffffff;
+  static const uint32_t RESYNC_INTERVAL = 1024; // Incremental updates between exact recomputations
+
+  // Adds a lightpath on the given channel over the given spans; its error model (may be null) is given
+  // the SNR now and whenever a neighbour changes it
+  uint32_t AddLightpath (const std::vector<uint32_t> &spans, uint32_t channel, Ptr<OpticalErrorModel> errorModel)
+  {
+    uint32_t id;
+    if (!m_freeIds.empty ())
+      {
+        id = m_freeIds.back ();
+        m_freeIds.pop_back ();
+      }
+    else
+      {
+        id = static_cast<uint32_t> (m_lightpaths.size ());
+        m_lightpaths.push_back (Lightpath ());
+      }
+    Lightpath &lightpath = m_lightpaths[id];
+    lightpath.spans = spans;
+    lightpath.channel = channel;
+    lightpath.errorModel = errorModel;
+    lightpath.active = true;
+    lightpath.dirty = false;
+    Apply (spans, channel, +1.0);
+    for (uint32_t span : spans)
+      {
+        m_spanLightpaths[span].push_back (id);
+      }
+    Resum (lightpath);
+    MarkDirty (id);
+    Flush ();
+    return id;
+  }
+
+  void RemoveLightpath (uint32_t id)
+  {
+    Lightpath &lightpath = m_lightpaths[id];
+    for (uint32_t span : lightpath.spans)
+      {
+        std::vector<uint32_t> &on = m_spanLightpaths[span];
+        on.erase (std::find (on.begin (), on.end (), id));
+      }
+    lightpath.active = false;
+    Apply (lightpath.spans, lightpath.channel, -1.0);
+    for (uint32_t span : lightpath.spans)
+      {
+        if (m_spanLightpaths[span].empty ())
+          { // Nothing left on the span: reset to exact zero so rounding cannot build up
+            std::fill (m_nli.begin () + static_cast<size_t> (span) * m_channels,
+                       m_nli.begin () + static_cast<size_t> (span + 1) * m_channels, 0.0);
+            m_spanChanges[span] = 0;
+          }
+      }
+    lightpath.errorModel = 0;
+    m_freeIds.push_back (id);
+    Flush ();
+  }
+
+  double GetSnrDb (uint32_t id) const { return -10.0 * std::log10 (m_lightpaths[id].nsr); }
+
+  // Reference: SNR of a lightpath from a full pairwise sum over the lit channels of its spans
+  double RecomputeSnrDb (uint32_t id) const
+  {
+    const Lightpath &lightpath = m_lightpaths[id];
+    double nsr = 0.0;
+    for (uint32_t span : lightpath.spans)
+      {
+        nsr += m_aseNsr;
+        for (uint32_t other : m_spanLightpaths[span])
+          {
+            nsr += Weight (lightpath.channel, m_lightpaths[other].channel);
+          }
+      }
+    return -10.0 * std::log10 (nsr);
+  }
+
+  const std::vector<uint32_t> &GetSpanLightpaths (uint32_t span) const { return m_spanLightpaths[span]; }
+  double GetAseNsr () const { return m_aseNsr; }
+  double GetWeight (uint32_t offset) const { return m_weights[offset]; }
+  uint64_t GetChannelUpdates () const { return m_channelUpdates; } // Per-channel NLI adjustments so far
+
+private:
+  struct Lightpath
+  {
+    std::vector<uint32_t> spans; // Route
+    uint32_t channel; // Grid channel
+    Ptr<OpticalErrorModel> errorModel; // Receiver fed with the SNR
+    double nsr; // 1/SNR over the whole path
+    uint32_t updates; // Incremental changes to nsr since it was last re-summed
+    bool active; // False once removed (id free for reuse)
+    bool dirty; // SNR changed since its error model was last updated
+  };
+
+  // NLI/P on one span of channel i caused by channel j (incoherent GN, rectangular spectra, equal power)
+  double Weight (uint32_t i, uint32_t j) const { return m_weights[i > j ? i - j : j - i]; }
+
+  void ComputeWeights ()
+  {
+    const SpanParameters &p = m_parameters;
+    const double h = 6.62607015e-34;
+    double alpha = p.alphaDbPerKm * std::log (10.0) / 10.0 / 1e3; // Power attenuation, 1/m
+    double power = 1e-3 * std::pow (10.0, p.launchPowerDbm / 10.0);
+    double b = p.symbolRateHz;
+
+    double gain = std::exp (alpha * p.lengthKm * 1e3); // EDFA makes up the span loss
+    double nf = std::pow (10.0, p.noiseFigureDb / 10.0);
+    m_aseNsr = nf * h * p.centreFrequencyHz * (gain - 1.0) * b / power;
+
+    // With equal powers and bandwidths, P_NLI,i / P_i = scale * (P / B)^2 * psi (df): the kernel's
+    // per-pair term (offset 0 is SPM)
+    GnSpanConstants c = GnSpanConstants::From (p.lengthKm, p.alphaDbPerKm, p.gammaPerWattKm, p.beta2Ps2PerKm);
+    double g = power / b;
+    m_weights.resize (m_channels);
+    for (uint32_t d = 0; d < m_channels; ++d)
+      {
+        m_weights[d] = c.scale * g * g * c.Psi (d * p.spacingHz, b);
+      }
+  }
+
+  // Adds (sign +1) or removes (-1) the channel's NLI contribution on each span, updating every channel's
+  // per-span NLI and the path totals of the lightpaths already there
+  void Apply (const std::vector<uint32_t> &spans, uint32_t channel, double sign)
+  {
+    for (uint32_t span : spans)
+      {
+        double *nli = &m_nli[static_cast<size_t> (span) * m_channels];
+        for (uint32_t i = 0; i < m_channels; ++i)
+          {
+            nli[i] += sign * Weight (i, channel);
+          }
+        m_channelUpdates += m_channels;
+        if (++m_spanChanges[span] == RESYNC_INTERVAL)
+          {
+            m_resyncSpans.push_back (span); // Rebuilt in Flush, once the span's lightpath list is current
+          }
+        for (uint32_t other : m_spanLightpaths[span])
+          {
+            Lightpath &neighbour = m_lightpaths[other];
+            neighbour.nsr += sign * Weight (neighbour.channel, channel);
+            ++neighbour.updates;
+            MarkDirty (other);
+          }
+      }
+  }
+
+  // Exact NLI of every channel on the span from the lightpaths on it; O(channels x lightpaths), every
+  // RESYNC_INTERVAL changes of the span
+  void RebuildSpan (uint32_t span)
+  {
+    double *nli = &m_nli[static_cast<size_t> (span) * m_channels];
+    std::fill (nli, nli + m_channels, 0.0);
+    for (uint32_t other : m_spanLightpaths[span])
+      {
+        uint32_t channel = m_lightpaths[other].channel;
+        for (uint32_t i = 0; i < m_channels; ++i)
+          {
+            nli[i] += Weight (i, channel);
+          }
+        m_lightpaths[other].updates = RESYNC_INTERVAL; // Re-summed from the rebuilt span at the next Flush
+      }
+    m_spanChanges[span] = 0;
+  }
+
+  // Path total from the per-span NLI (which includes the lightpath's own SPM), O(hops)
+  void Resum (Lightpath &lightpath)
+  {
+    lightpath.nsr = 0.0;
+    for (uint32_t span : lightpath.spans)
+      {
+        lightpath.nsr += m_aseNsr + m_nli[static_cast<size_t> (span) * m_channels + lightpath.channel];
+      }
+    lightpath.updates = 0;
+  }
+
+  void MarkDirty (uint32_t id)
+  {
+    if (!m_lightpaths[id].dirty)
+      {
+        m_lightpaths[id].dirty = true;
+        m_dirty.push_back (id);
+      }
+  }
+
+  // Hands the new SNRs to the error models, once per lightpath however many of its spans changed
+  void Flush ()
+  {
+    for (uint32_t span : m_resyncSpans)
+      {
+        RebuildSpan (span); // Its lightpaths are all in m_dirty: Apply just touched them
+      }
+    m_resyncSpans.clear ();
+    for (uint32_t id : m_dirty)
+      {
+        Lightpath &lightpath = m_lightpaths[id];
+        lightpath.dirty = false;
+        if (lightpath.active && lightpath.updates >= RESYNC_INTERVAL)
+          {
+            Resum (lightpath);
+          }
+        if (lightpath.active && lightpath.errorModel)
+          {
+            lightpath.errorModel->SetSnrDb (GetSnrDb (id));
+          }
+      }
+    m_dirty.clear ();
+  }
+
+  uint32_t m_channels; // Grid channels per span
+  SpanParameters m_parameters; // Fiber, amplifier and signal
+  double m_aseNsr; // ASE/P of one span
+  std::vector<double> m_weights; // NLI/P by channel offset
+  std::vector<double> m_nli; // Span-major: NLI/P each channel would see on the span
+  std::vector<std::vector<uint32_t> > m_spanLightpaths; // Lightpaths on each span
+  std::vector<uint32_t> m_spanChanges; // Changes to each span's NLI since it was last rebuilt
+  std::vector<uint32_t> m_resyncSpans; // Spans due for a rebuild at the next Flush
+  std::vector<Lightpath> m_lightpaths; // By id
+  std::vector<uint32_t> m_freeIds; // Removed ids, reused first
+  std::vector<uint32_t> m_dirty; // Lightpaths whose error model needs the new SNR
+  uint64_t m_channelUpdates; // Work counter
+};
+
+// ------------------ Dynamic Lightpaths ------------------
+struct BlockingEstimate
+{
+  uint64_t requests; // Counted (after warm-up)
+  uint64_t blocked; // Of those, blocked
+  double probability; // blocked / requests
+  double ci95; // Half-width of the 95% confidence interval (batch means)
+};
+
+class BlockingBatchMeans
+{ // Blocking probability with a batch-means confidence interval: consecutive requests are grouped
+  // into fixed-size batches whose blocking ratios are treated as independent samples
+public:
+  explicit BlockingBatchMeans (uint64_t batchSize)
+    : m_batchSize (std::max<uint64_t> (1, batchSize))
+  {
+  }
+
+  void Add (bool blocked)
+  {
+    if (m_batches.empty () || m_batches.back ().first == m_batchSize)
+      {
+        m_batches.push_back (std::make_pair (0, 0));
+      }
+    ++m_batches.back ().first;
+    m_batches.back ().second += blocked ? 1 : 0;
+  }
+
+  BlockingEstimate GetEstimate () const
+  {
+    BlockingEstimate estimate;
+    estimate.requests = 0;
+    estimate.blocked = 0;
+    for (const std::pair<uint64_t, uint64_t> &batch : m_batches)
+      {
+        estimate.requests += batch.first;
+        estimate.blocked += batch.second;
+      }
+    estimate.probability = estimate.requests > 0 ? static_cast<double> (estimate.blocked) / estimate.requests : 0.0;
+    estimate.ci95 = 0.0;
+    uint32_t full = 0;
+    double sum = 0.0;
+    double sumSq = 0.0;
+    for (const std::pair<uint64_t, uint64_t> &batch : m_batches)
+      {
+        if (batch.first == m_batchSize)
+          {
+            double p = static_cast<double> (batch.second) / batch.first;
+            sum += p;
+            sumSq += p * p;
+            ++full;
+          }
+      }
+    if (full > 1)
+      { // Student t (two-sided 95%) over the batch means; 1.96 beyond 30 batches
+        static const double t95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        double mean = sum / full;
+        double variance = std::max (0.0, (sumSq - full * mean * mean) / (full - 1));
+        double t = full - 1 <= 30 ? t95[full - 2] : 1.96;
+        estimate.ci95 = t * std::sqrt (variance / full);
+      }
+    return estimate;
+  }
+
+private:
+  uint64_t m_batchSize; // Requests per batch
+  std::vector<std::pair<uint64_t, uint64_t> > m_batches; // (requests, blocked) per batch
+};
+
+class DynamicLightpathManager
+{ // Erlang traffic of lightpaths on a RoadmTopology: Poisson arrivals between random node pairs,
+  // exponential holding times. Each accepted request is routed by the RwaEngine and holds its spectrum
+  // until its departure. Only blocking and spectrum occupancy are modelled: lightpaths create no devices
+  // and carry no packets. A request costs two events, a route lookup (cached per node pair) and O(hops)
+  // bitset work, whatever the network size.
+public:
+  struct Config
+  {
+    double arrivalRate; // Requests per second
+    Time meanHolding; // Mean lightpath lifetime (offered load = arrivalRate * meanHolding Erlang)
+    uint64_t requests; // Arrivals to simulate
+    uint64_t warmup; // First arrivals left out of the blocking estimate (network filling from empty)
+    uint32_t batches; // Batch-means batches for the confidence interval
+    std::vector<uint32_t> widths; // Units per request, cycled (1 on a fixed grid)
+  };
+
+  DynamicLightpathManager (const RoadmTopology &topology, RwaEngine &engine, const Config &config)
+    : m_topology (topology),
+      m_engine (engine),
+      m_config (config),
+      m_blocking (BatchSize (config)),
+      m_arrivals (0),
+      m_peakActive (0),
+      m_activeCount (0),
+      m_qot (0),
+      m_setupSnrSumDb (0.0),
+      m_setupSnrCount (0)
+  {
+    m_interArrival = CreateObject<ExponentialRandomVariable> ();
+    m_interArrival->SetAttribute ("Mean", DoubleValue (1.0 / config.arrivalRate));
+    m_holding = CreateObject<ExponentialRandomVariable> ();
+    m_holding->SetAttribute ("Mean", DoubleValue (config.meanHolding.GetSeconds ()));
+    m_endpoints = CreateObject<UniformRandomVariable> ();
+  }
+
+  // Requests per batch so that the counted (post warm-up) requests make config.batches batches
+  static uint64_t BatchSize (const Config &config)
+  {
+    uint64_t counted = config.requests > config.warmup ? config.requests - config.warmup : 0;
+    return counted / std::max (config.batches, 1u);
+  }
+
+  void Start () { Simulator::Schedule (Seconds (m_interArrival->GetValue ()), &DynamicLightpathManager::Arrival, this); }
+
+  BlockingEstimate GetBlocking () const { return m_blocking.GetEstimate (); }
+
+  // Tracks the GN-model SNR of every fixed-grid lightpath as neighbours come and go. No receiver
+  // consumes it, so lightpaths are registered without an error model
+  void SetQot (QotEngine *qot) { m_qot = qot; }
+  double GetMeanSetupSnrDb () const { return m_setupSnrCount > 0 ? m_setupSnrSumDb / m_setupSnrCount : 0.0; }
+
+  uint32_t GetPeakActive () const { return m_peakActive; }
+
+private:
+  struct Active
+  {
+    RwaEngine::Lightpath lightpath; // Route and spectrum
+    uint32_t qotId; // Id in the QoT engine, or QotEngine::NO_LIGHTPATH
+  };
+
+  void Arrival ()
+  {
+    uint64_t index = m_arrivals++;
+    uint32_t n = m_topology.GetNNodes ();
+    uint32_t src = m_endpoints->GetInteger (0, n - 1);
+    uint32_t dst = m_endpoints->GetInteger (0, n - 2);
+    dst += dst >= src ? 1 : 0; // Any node but src
+    uint32_t width = m_config.widths[index % m_config.widths.size ()];
+
+    Active active;
+    bool accepted = m_engine.Setup (src, dst, width, active.lightpath);
+    if (index >= m_config.warmup)
+      {
+        m_blocking.Add (!accepted);
+      }
+    if (accepted)
+      {
+        active.qotId = QotEngine::NO_LIGHTPATH;
+        if (m_qot && width == 1)
+          {
+            active.qotId = m_qot->AddLightpath (active.lightpath.spans, active.lightpath.lambda, 0);
+            m_setupSnrSumDb += m_qot->GetSnrDb (active.qotId);
+            ++m_setupSnrCount;
+          }
+        uint32_t id;
+        if (!m_freeIds.empty ())
+          {
+            id = m_freeIds.back ();
+            m_freeIds.pop_back ();
+            m_active[id] = active;
+          }
+        else
+          {
+            id = static_cast<uint32_t> (m_active.size ());
+            m_active.push_back (active);
+          }
+        m_peakActive = std::max (m_peakActive, ++m_activeCount);
+        Simulator::Schedule (Seconds (m_holding->GetValue ()), &DynamicLightpathManager::Departure, this, id);
+      }
+
+    if (m_arrivals < m_config.requests)
+      {
+        Simulator::Schedule (Seconds (m_interArrival->GetValue ()), &DynamicLightpathManager::Arrival, this);
+      }
+    else
+      {
+        Simulator::Stop (); // Lightpaths still up do not change the estimate
+      }
+  }
+
+  void Departure (uint32_t id)
+  {
+    Active &active = m_active[id];
+    m_engine.Release (active.lightpath);
+    if (active.qotId != QotEngine::NO_LIGHTPATH)
+      {
+        m_qot->RemoveLightpath (active.qotId);
+      }
+    m_freeIds.push_back (id);
+    --m_activeCount;
+  }
+
+  const RoadmTopology &m_topology; // Network the lightpaths cross
+  RwaEngine &m_engine; // Routing and spectrum state
+  Config m_config; // Traffic and estimation settings
+  Ptr<ExponentialRandomVariable> m_interArrival; // Poisson arrivals
+  Ptr<ExponentialRandomVariable> m_holding; // Lightpath lifetimes
+  Ptr<UniformRandomVariable> m_endpoints; // Source/destination draws
+  std::vector<Active> m_active; // Lit lightpaths, by id
+  std::vector<uint32_t> m_freeIds; // Ids of departed lightpaths, reused first
+  BlockingBatchMeans m_blocking; // Blocking after warm-up
+  uint64_t m_arrivals; // Arrivals so far
+  uint32_t m_peakActive; // Most lightpaths up at once
+  uint32_t m_activeCount; // Lightpaths up now
+  QotEngine *m_qot; // Optional SNR source for each lightpath
+  double m_setupSnrSumDb; // Sum of lightpath SNRs at setup
+  uint64_t m_setupSnrCount; // Lightpaths with a QoT SNR
+};
+
+class MonteCarloBlocking
+{ // Flow-free version of DynamicLightpathManager for capacity planning: the same arrival/departure
+  // process and RWA, but no devices, packets or ns-3 scheduler. Departures sit in a local min-heap and
+  // the next arrival is drawn inline, so a request is a few RNG draws, one route lookup, O(hops) bitset
+  // work and a heap push/pop. Also integrates spectrum utilisation (occupied span-units over time).
+public:
+  struct Result
+  {
+    BlockingEstimate blocking; // After warm-up
+    double utilisation; // Time-averaged fraction of span-units lit (after warm-up)
+    double seconds; // Wall time
+  };
+
+  MonteCarloBlocking (const RoadmTopology &topology, RwaEngine &engine, const DynamicLightpathManager::Config &config)
+    : m_topology (topology),
+      m_engine (engine),
+      m_config (config)
+  {
+  }
+
+  Result Run ()
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    BlockingBatchMeans blocking (DynamicLightpathManager::BatchSize (m_config));
+    Xoshiro256ppRng random;
+    random.BeginPacket (RngSeedManager::GetSeed (), RngSeedManager::GetRun ());
+    double meanGap = 1.0 / m_config.arrivalRate;
+    double meanHolding = m_config.meanHolding.GetSeconds ();
+    uint32_t n = m_topology.GetNNodes ();
+
+    std::vector<RwaEngine::Lightpath> active; // Slot per lit lightpath; spans vectors keep their capacity
+    std::vector<uint32_t> freeSlots;
+    std::priority_queue<std::pair<double, uint32_t>, std::vector<std::pair<double, uint32_t> >,
+                        std::greater<std::pair<double, uint32_t> > > departures; // (time, slot)
+    double now = 0.0;
+    double litUnits = 0.0; // Span-units lit now
+    double litIntegral = 0.0; // Integral of litUnits over time, after warm-up
+    double countedFrom = 0.0; // Time the warm-up ended
+
+    for (uint64_t r = 0; r < m_config.requests; ++r)
+      {
+        double arrival = now - std::log (1.0 - random.Uniform ()) * meanGap;
+        while (!departures.empty () && departures.top ().first <= arrival)
+          {
+            std::pair<double, uint32_t> departure = departures.top ();
+            departures.pop ();
+            litIntegral += r > m_config.warmup ? litUnits * (departure.first - now) : 0.0;
+            now = departure.first;
+            const RwaEngine::Lightpath &lightpath = active[departure.second];
+            litUnits -= static_cast<double> (lightpath.width) * lightpath.spans.size ();
+            m_engine.Release (lightpath);
+            freeSlots.push_back (departure.second);
+          }
+        litIntegral += r > m_config.warmup ? litUnits * (arrival - now) : 0.0;
+        now = arrival;
+        if (r == m_config.warmup)
+          {
+            countedFrom = now;
+          }
+
+        uint32_t src = static_cast<uint32_t> (random.Next () % n);
+        uint32_t dst = static_cast<uint32_t> (random.Next () % (n - 1));
+        dst += dst >= src ? 1 : 0; // Any node but src
+        uint32_t width = m_config.widths[r % m_config.widths.size ()];
+        uint32_t slot;
+        if (!freeSlots.empty ())
+          {
+            slot = freeSlots.back ();
+            freeSlots.pop_back ();
+          }
+        else
+          {
+            slot = static_cast<uint32_t> (active.size ());
+            active.push_back (RwaEngine::Lightpath ());
+          }
+        bool accepted = m_engine.Setup (src, dst, width, active[slot]);
+        if (r >= m_config.warmup)
+          {
+            blocking.Add (!accepted);
+          }
+        if (accepted)
+          {
+            litUnits += static_cast<double> (width) * active[slot].spans.size ();
+            departures.push (std::make_pair (now - std::log (1.0 - random.Uniform ()) * meanHolding, slot));
+          }
+        else
+          {
+            freeSlots.push_back (slot);
+          }
+      }
+
+    Result result;
+    result.blocking = blocking.GetEstimate ();
+    double capacity = static_cast<double> (m_topology.GetNSpans ()) * m_engine.GetOccupancy ().GetUnits ();
+    result.utilisation = now > countedFrom && capacity > 0 ? litIntegral / (now - countedFrom) / capacity : 0.0;
+    result.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    return result;
+  }
+
+private:
+  const RoadmTopology &m_topology; // Network the lightpaths cross
+  RwaEngine &m_engine; // Routing and spectrum state
+  DynamicLightpathManager::Config m_config; // Same traffic settings as the packet-level run
+};
+
+// ------------------ Scenario Configuration ------------------
+// Per-wavelength link, error and traffic settings. The table is parsed once into typed values
+// (DataRate / Time), so configuring 96 wavelengths does no per-wavelength attribute string parsing.
+struct TrafficProfile
+{
+  uint32_t maxPackets; // Packets the UdpEcho client sends
+  Time interval; // Gap between packets
+  uint32_t packetSize; // Payload bytes
+  Time start; // Client start time
+};
+
+struct WavelengthConfig
+{
+  DataRate rate; // Line rate
+  Time delay; // Propagation delay
+  double ber; // Channel BER
+  double snrDb; // SNR in dB
+  TrafficProfile traffic; // UdpEcho client on this wavelength
+};
+
+class ScenarioConfig
+{
+public:
+  // Applications and the simulation stop here, so every client has to start before it
+  static Time StopTime () { return Seconds (30.0); }
+  // Start of a client whose row gives none: 10 ms apart from 2 s, so even 96+ wavelengths all start
+  // well inside the run
+  static Time DefaultStart (uint32_t row) { return Seconds (2.0) + MilliSeconds (10 * static_cast<uint64_t> (row)); }
+
+  // The original two asymmetric wavelengths
+  static std::vector<WavelengthConfig> Default ()
+  {
+    std::vector<WavelengthConfig> table (2);
+    table[0].rate = DataRate (10000000000ULL); // Wavelength 0: 10 Gbps, 2 ms, BER 1e-7, 25 dB
+    table[0].delay = MilliSeconds (2);
+    table[0].ber = 1e-7;
+    table[0].snrDb = 25.0;
+    table[0].traffic.maxPackets = 2000; // 1024 B every 2 ms
+    table[0].traffic.interval = Seconds (0.002);
+    table[0].traffic.packetSize = 1024;
+    table[0].traffic.start = Seconds (2.0);
+    table[1].rate = DataRate (5000000000ULL); // Wavelength 1: 5 Gbps, 5 ms, BER 1e-6, 30 dB
+    table[1].delay = MilliSeconds (5);
+    table[1].ber = 1e-6;
+    table[1].snrDb = 30.0;
+    table[1].traffic.maxPackets = 500; // 512 B every 50 ms
+    table[1].traffic.interval = Seconds (0.05);
+    table[1].traffic.packetSize = 512;
+    table[1].traffic.start = Seconds (3.0);
+    return table;
+  }
+
+  // One wavelength per line: dataRate,delay,ber,snrDb,maxPackets,interval,packetSize[,start]
+  // e.g. "10Gbps,2ms,1e-7,25,2000,2ms,1024,2s". Rates take bps/kbps/Mbps/Gbps/Tbps, times s/ms/us/ns
+  // (plain numbers are bps and seconds). Blank lines, '#' comments and a header line are skipped.
+  // Without a start column, row i starts at DefaultStart (i); a start at or after StopTime () is an error.
+  static std::vector<WavelengthConfig> LoadCsv (const std::string &path)
+  {
+    std::ifstream in (path.c_str ());
+    if (!in)
+      {
+        NS_FATAL_ERROR ("Cannot open scenario file " << path);
+      }
+    std::vector<WavelengthConfig> table;
+    std::string line;
+    uint32_t lineNumber = 0;
+    while (std::getline (in, line))
+      {
+        ++lineNumber;
+        std::string::size_type first = line.find_first_not_of (" \t\r");
+        if (first == std::string::npos || line[first] == '#' || std::isalpha (static_cast<unsigned char> (line[first])))
+          {
+            continue; // Blank, comment or header
+          }
+        std::vector<std::string> fields;
+        std::istringstream columns (line);
+        std::string field;
+        while (std::getline (columns, field, ','))
+          {
+            fields.push_back (field);
+          }
+        if (fields.size () < 7 || fields.size () > 8)
+          {
+            NS_FATAL_ERROR (path << ":" << lineNumber << ": expected 7 or 8 comma-separated fields");
+          }
+        WavelengthConfig config;
+        bool ok = ParseRate (fields[0], config.rate) && ParseTime (fields[1], config.delay)
+                  && ParseNumber (fields[2], config.ber) && ParseNumber (fields[3], config.snrDb)
+                  && ParseCount (fields[4], config.traffic.maxPackets) && ParseTime (fields[5], config.traffic.interval)
+                  && ParseCount (fields[6], config.traffic.packetSize);
+        config.traffic.start = DefaultStart (static_cast<uint32_t> (table.size ()));
+        if (ok && fields.size () == 8)
+          {
+            ok = ParseTime (fields[7], config.traffic.start);
+          }
+        if (!ok)
+          {
+            NS_FATAL_ERROR (path << ":" << lineNumber << ": malformed field in '" << line << "'");
+          }
+        if (config.traffic.start >= StopTime ())
+          {
+            NS_FATAL_ERROR (path << ":" << lineNumber << ": start " << config.traffic.start.GetSeconds ()
+                                 << " s is not before the end of the run (" << StopTime ().GetSeconds () << " s)");
+          }
+        table.push_back (config);
+      }
+    if (table.empty ())
+      {
+        NS_FATAL_ERROR ("Scenario file " << path << " defines no wavelengths");
+      }
+    return table;
+  }
+
+private:
+  // Number with an optional unit suffix; 'scale' maps the suffix (lower case) to a multiplier
+  static bool ParseWithUnit (const std::string &text, double &value, double (*scale) (const std::string &))
+  {
+    const char *begin = text.c_str ();
+    char *end = nullptr;
+    value = std::strtod (begin, &end);
+    if (end == begin)
+      {
+        return false;
+      }
+    std::string unit;
+    for (; *end != '\0'; ++end)
+      {
+        if (!std::isspace (static_cast<unsigned char> (*end)))
+          {
+            unit += static_cast<char> (std::tolower (static_cast<unsigned char> (*end)));
+          }
+      }
+    double multiplier = scale (unit);
+    if (multiplier <= 0.0)
+      {
+        return false;
+      }
+    value *= multiplier;
+    return true;
+  }
+
+  static double RateUnit (const std::string &unit)
+  {
+    if (unit.empty () || unit == "bps")
+      {
+        return 1.0;
+      }
+    if (unit == "kbps")
+      {
+        return 1e3;
+      }
+    if (unit == "mbps")
+      {
+        return 1e6;
+      }
+    if (unit == "gbps")
+      {
+        return 1e9;
+      }
+    if (unit == "tbps")
+      {
+        return 1e12;
+      }
+    return 0.0;
+  }
+
+  static double TimeUnit (const std::string &unit)
+  {
+    if (unit.empty () || unit == "s")
+      {
+        return 1.0;
+      }
+    if (unit == "ms")
+      {
+        return 1e-3;
+      }
+    if (unit == "us")
+      {
+        return 1e-6;
+      }
+    if (unit == "ns")
+      {
+        return 1e-9;
+      }
+    return 0.0;
+  }
+
+  static double NoUnit (const std::string &unit) { return unit.empty () ? 1.0 : 0.0; }
 
-// ------------------ Custom Error Model ------------------
-class OpticalErrorModel : public ErrorModel
-{ // This part simulates error characteristics such as packet corruption that happens during transmission-
-  // based on BER (the probability of a bit being corrupted), and SNR (used to access the quality of the signal)
-public:
-  static TypeId GetTypeId (void)
-  { // Register the class as an NS-3 type system; it allows the class to be instantiated within NS-3
-    static TypeId tid = TypeId ("OpticalErrorModel")
-      .SetParent<ErrorModel> ()
-      .SetGroupName("Network")
-      .AddConstructor<OpticalErrorModel> ();
-    return tid;
+  static bool ParseRate (const std::string &text, DataRate &rate)
+  {
+    double bps;
+    if (!ParseWithUnit (text, bps, &RateUnit) || bps <= 0.0)
+      {
+        return false;
+      }
+    rate = DataRate (static_cast<uint64_t> (bps + 0.5));
+    return true;
   }
 
-  OpticalErrorModel () // This onstructor initializes the error model with the default BER and SNR values
-    : m_random (CreateObject<UniformRandomVariable> ()), // RNG to simulate randomness in packet corruption
-      m_ber (1e-8), // Default BER 
-      m_snrDb (30.0) // Default SNR in dB
+  static bool ParseTime (const std::string &text, Time &time)
   {
+    double seconds;
+    if (!ParseWithUnit (text, seconds, &TimeUnit) || seconds < 0.0)
+      {
+        return false;
+      }
+    time = Seconds (seconds);
+    return true;
   }
-  // Setters and Getters of the Error Model
-  void SetBer (double ber) { m_ber = ber; }
-  void SetSnrDb (double snrDb) { m_snrDb = snrDb; }
 
-  double GetBer () const { return m_ber; }
-  double GetSnrDb () const { return m_snrDb; }
+  static bool ParseNumber (const std::string &text, double &value)
+  {
+    return ParseWithUnit (text, value, &NoUnit);
+  }
 
-// Packet corruption logic
-private:
-  virtual bool DoCorrupt (Ptr<Packet> p) override
+  static bool ParseCount (const std::string &text, uint32_t &count)
   {
-    // Very basic bit-flip approach
-    uint32_t bits = p->GetSize () * 8; // iterate through all the bits in the packet
-    for (uint32_t i = 0; i < bits; ++i)
+    double value;
+    if (!ParseWithUnit (text, value, &NoUnit) || value < 0.0 || value > 4294967295.0)
+      {
+        return false;
+      }
+    count = static_cast<uint32_t> (value);
+    return true;
+  }
+};
+
+// Value of a --name=value argument before CommandLine::Parse runs (empty if absent); used for the options
+// that decide which other options exist
+std::string
+PeekArgument (int argc, char *argv[], const std::string &name)
+{
+  std::string prefix = "--" + name + "=";
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg (argv[i]);
+      if (arg.compare (0, prefix.size (), prefix) == 0)
+        {
+          return arg.substr (prefix.size ());
+        }
+    }
+  return "";
+}
+
+// ------------------ Microbenchmarks ------------------
+// Per-bit decision cost for the packet sizes of the two flows in main(): the original loop (one virtual
+// MRG32k3a draw per bit), the inlined xoshiro256++ scalar loop and the fused SIMD block kernel.
+template <class F>
+double NanosecondsPerCall (F f, uint32_t calls)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  for (uint32_t i = 0; i < calls; ++i)
+    {
+      f (i);
+    }
+  return std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now () - start).count () / calls;
+}
+
+void
+RunErrorModelBenchmark ()
+{
+  const uint32_t packets = 20000;
+  const double ber = 1e-7;
+  Ptr<UniformRandomVariable> uniform = CreateObject<UniformRandomVariable> ();
+  Xoshiro256ppRng scalar;
+  SimdXoshiroRng simd;
+  uint64_t corrupted = 0; // Keeps the loops from being optimised away
+
+  NS_LOG_UNCOND ("Per-bit error decision, BER " << ber << ", ns per packet");
+  uint32_t sizes[] = {1024, 512};
+  for (uint32_t size : sizes)
+    {
+      uint32_t bits = size * 8;
+      double legacy = NanosecondsPerCall ([&] (uint32_t) {
+        for (uint32_t i = 0; i < bits; ++i)
+          {
+            if (uniform->GetValue () < ber)
+              {
+                ++corrupted;
+                break;
+              }
+          }
+      }, packets);
+      double inlined = NanosecondsPerCall ([&] (uint32_t uid) {
+        scalar.BeginPacket (1, uid);
+        corrupted += FirstErrorBit (scalar, ber, bits) < bits;
+      }, packets);
+      double vectorised = NanosecondsPerCall ([&] (uint32_t uid) {
+        simd.BeginPacket (1, uid);
+        corrupted += simd.FirstBelow (ber, bits) < bits;
+      }, packets);
+      NS_LOG_UNCOND ("  " << size << " B: MRG32k3a loop " << legacy << ", xoshiro256++ block " << inlined
+                          << ", SIMD block " << vectorised << " (" << legacy / vectorised << "x)");
+    }
+  NS_LOG_UNCOND ("  (" << corrupted << " packets corrupted in total)");
+}
+
+// Checks the RNG policies the error model inlines: Philox4x32-10 and xoshiro256++ against published
+// known answers, and SimdXoshiroRng's vector search against its own Uniform () stream, in whatever
+// instruction set this binary was built for. Returns false if anything differs.
+bool
+RunRngSelfCheck ()
+{
+  uint32_t failures = 0;
+
+  // Random123 known-answer vectors: counter, key, expected output
+  const uint32_t philox[3][10] = {
+      {0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+       0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+      {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+       0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+      {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+       0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+  uint32_t philoxFailures = 0;
+  for (uint32_t v = 0; v < 3; ++v)
+    {
+      uint32_t c[4] = {philox[v][0], philox[v][1], philox[v][2], philox[v][3]};
+      PhiloxRng::Encrypt (c, &philox[v][4]);
+      for (uint32_t i = 0; i < 4; ++i)
+        {
+          philoxFailures += c[i] != philox[v][6 + i];
+        }
+    }
+  PhiloxRng philoxRng; // Key 0, uid 0, block 0 is the first vector; words 0-1 make the first draw
+  philoxRng.BeginPacket (0, 0);
+  philoxFailures += philoxRng.Uniform () != ToUniform (0xe169c58d6627e8d5ULL);
+  NS_LOG_UNCOND ("Philox4x32-10 known answers: " << (philoxFailures == 0 ? "pass" : "FAIL"));
+  failures += philoxFailures;
+
+  // Reference xoshiro256++ output from state {1, 2, 3, 4}
+  const uint64_t xoshiro[10] = {41943041ULL, 58720359ULL, 3588806011781223ULL, 3591011842654386ULL,
+                                9228616714210784205ULL, 9973669472204895162ULL, 14011001112246962877ULL,
+                                12406186145184390807ULL, 15849039046786891736ULL, 10450023813501588000ULL};
+  uint64_t state[4] = {1, 2, 3, 4};
+  uint32_t xoshiroFailures = 0;
+  for (uint32_t i = 0; i < 10; ++i)
+    {
+      xoshiroFailures += Xoshiro256ppRng::Next (state) != xoshiro[i];
+    }
+  NS_LOG_UNCOND ("xoshiro256++ known answers: " << (xoshiroFailures == 0 ? "pass" : "FAIL"));
+  failures += xoshiroFailures;
+
+  // Lane 0 of the SIMD generator is seeded like the scalar one, so draws 0, 8, 16, ... must match it.
+  // Then random mixes of Uniform () and FirstBelow must match a Uniform ()-only reference draw for draw,
+  // including the draws after each FirstBelow (the stream position).
+  const uint32_t trials = 20000;
+  Xoshiro256ppRng driver;
+  driver.BeginPacket (RngSeedManager::GetSeed (), RngSeedManager::GetRun ());
+  const double probabilities[] = {1e-4, 1e-3, 1e-2, 0.1, 0.5, 1.0};
+  uint32_t laneFailures = 0;
+  uint32_t positionFailures = 0;
+  for (uint32_t trial = 0; trial < trials; ++trial)
+    {
+      uint64_t streamKey = driver.Next ();
+      Xoshiro256ppRng scalar;
+      SimdXoshiroRng lanes;
+      scalar.BeginPacket (streamKey, trial);
+      lanes.BeginPacket (streamKey, trial);
+      for (uint32_t step = 0; step < 4; ++step)
+        {
+          laneFailures += lanes.Uniform () != scalar.Uniform ();
+          for (uint32_t lane = 1; lane < SimdXoshiroRng::LANES; ++lane)
+            {
+              lanes.Uniform ();
+            }
+        }
+
+      SimdXoshiroRng vector;
+      SimdXoshiroRng reference;
+      vector.BeginPacket (streamKey, trial);
+      reference.BeginPacket (streamKey, trial);
+      for (uint32_t call = 0; call < 16; ++call)
+        {
+          if (driver.Next () % 2 == 0)
+            {
+              positionFailures += vector.Uniform () != reference.Uniform ();
+              continue;
+            }
+          double p = probabilities[driver.Next () % (sizeof (probabilities) / sizeof (probabilities[0]))];
+          uint32_t n = 1 + static_cast<uint32_t> (driver.Next () % 100);
+          uint32_t expected = n;
+          for (uint32_t i = 0; i < n; ++i)
+            {
+              if (reference.Uniform () < p)
+                {
+                  expected = i;
+                  break;
+                }
+            }
+          positionFailures += vector.FirstBelow (p, n) != expected;
+        }
+      positionFailures += vector.Uniform () != reference.Uniform ();
+    }
+  NS_LOG_UNCOND ("SIMD xoshiro256++ lane 0 against scalar: " << (laneFailures == 0 ? "pass" : "FAIL") << " ("
+                                                             << laneFailures << " mismatches)");
+  NS_LOG_UNCOND ("SIMD FirstBelow stream positions, " << trials << " random mixes: "
+                                                      << (positionFailures == 0 ? "pass" : "FAIL") << " ("
+                                                      << positionFailures << " mismatches)");
+  failures += laneFailures + positionFailures;
+  return failures == 0;
+}
+
+// Value below which a fraction q of the histograms' pooled samples fall (upper edge of that bin); the
+// histograms must share their bin width, as the delay histograms of one FlowMonitor do
+double
+HistogramPercentile (const std::vector<const Histogram *> &histograms, double q)
+{
+  uint32_t bins = 0;
+  uint64_t total = 0;
+  for (const Histogram *histogram : histograms)
+    {
+      bins = std::max (bins, histogram->GetNBins ());
+      for (uint32_t i = 0; i < histogram->GetNBins (); ++i)
+        {
+          total += histogram->GetBinCount (i);
+        }
+    }
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < bins; ++i)
+    {
+      const Histogram *widest = 0;
+      for (const Histogram *histogram : histograms)
+        {
+          if (i < histogram->GetNBins ())
+            {
+              seen += histogram->GetBinCount (i);
+              widest = histogram;
+            }
+        }
+      if (total > 0 && seen >= q * total)
+        {
+          return widest->GetBinEnd (i);
+        }
+    }
+  return 0.0;
+}
+
+// Same for one histogram
+double
+HistogramPercentile (const Histogram &histogram, double q)
+{
+  return HistogramPercentile (std::vector<const Histogram *> (1, &histogram), q);
+}
+
+// Flexgrid allocation throughput: random lightpaths of 2-8 slots over a 4-span path, allocated first-fit
+// and released in FIFO order at ~80% fill, with the shift-and block search and a slot-by-slot scan
+void
+RunFlexgridBenchmark ()
+{
+  const uint32_t allocations = 1000000;
+  std::vector<uint32_t> path;
+  for (uint32_t span = 0; span < 4; ++span)
+    {
+      path.push_back (span);
+    }
+  NS_LOG_UNCOND ("Flexgrid contiguous-slot allocation, 4-span path, allocations per second");
+  uint32_t slotCounts[] = {320, 768};
+  for (uint32_t slots : slotCounts)
+    {
+      double rates[2];
+      for (int naive = 0; naive < 2; ++naive)
+        {
+          SpectrumOccupancy occupancy;
+          occupancy.Reset (4, slots);
+          std::vector<uint64_t> free (occupancy.GetWords ());
+          std::deque<std::pair<uint32_t, uint32_t> > active; // (first slot, width), oldest first
+          uint32_t used = 0;
+          uint64_t placed = 0;
+          Xoshiro256ppRng random;
+          random.BeginPacket (slots, 0);
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+          for (uint32_t a = 0; a < allocations; ++a)
+            {
+              uint32_t width = 2 + static_cast<uint32_t> (random.Next () % 7);
+              while (!active.empty () && used + width > slots * 8 / 10)
+                {
+                  occupancy.Release (path, active.front ().first, active.front ().second);
+                  used -= active.front ().second;
+                  active.pop_front ();
+                }
+              occupancy.FreeOnPath (path, &free[0]);
+              uint32_t first = slots;
+              if (naive)
+                {
+                  uint32_t run = 0;
+                  for (uint32_t slot = 0; slot < slots && first == slots; ++slot)
+                    {
+                      run = (free[slot / 64] >> (slot % 64)) & 1 ? run + 1 : 0;
+                      first = run == width ? slot + 1 - width : slots;
+                    }
+                }
+              else
+                {
+                  first = SpectrumOccupancy::FirstFreeBlock (&free[0], occupancy.GetWords (), width);
+                }
+              if (first < slots)
+                {
+                  occupancy.Occupy (path, first, width);
+                  active.push_back (std::make_pair (first, width));
+                  used += width;
+                  ++placed;
+                }
+            }
+          double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+          rates[naive] = allocations / seconds;
+          if (naive == 0)
+            {
+              NS_LOG_UNCOND ("  (" << slots << " slots: " << placed << " of " << allocations << " placed)");
+            }
+        }
+      NS_LOG_UNCOND ("  " << slots << " slots: shift-and " << rates[0] << ", slot scan " << rates[1] << " ("
+                          << rates[0] / rates[1] << "x)");
+    }
+}
+
+// QoT update cost on a 1000-span chain with 96 channels: lightpaths over 1-20 consecutive spans come and
+// go at ~70% load; each change is applied incrementally, and separately timed as a full pairwise
+// recompute of every lightpath sharing a span with it. Also checks the incremental SNRs against it.
+void
+RunQotBenchmark ()
+{
+  const uint32_t spans = 1000;
+  const uint32_t channels = 96;
+  const uint32_t changes = 20000;
+  QotEngine qot (spans, channels, QotEngine::SpanParameters::Default ());
+  SpectrumOccupancy occupancy;
+  occupancy.Reset (spans, channels);
+  std::vector<uint64_t> free (occupancy.GetWords ());
+  Xoshiro256ppRng random;
+  random.BeginPacket (2, 0);
+  std::deque<std::pair<uint32_t, std::pair<std::vector<uint32_t>, uint32_t> > > active; // (id, (spans, channel))
+  uint64_t litUnits = 0;
+  double recomputeSeconds = 0.0;
+  double incrementalSeconds = 0.0;
+  double referenceSnrSum = 0.0; // Keeps the reference loop from being optimised away
+  uint64_t referenceCount = 0;
+  for (uint32_t c = 0; c < changes; ++c)
+    {
+      std::vector<uint32_t> path;
+      uint32_t first = static_cast<uint32_t> (random.Next () % spans);
+      uint32_t hops = 1 + static_cast<uint32_t> (random.Next () % 20);
+      for (uint32_t span = first; span < std::min (spans, first + hops); ++span)
+        {
+          path.push_back (span);
+        }
+      bool remove = !active.empty () && litUnits + path.size () > spans * channels * 7 / 10;
+      const std::vector<uint32_t> &changed = remove ? active.front ().second.first : path;
+      // Reference cost: recompute every lightpath that shares a span with the change
+      std::chrono::steady_clock::time_point naiveStart = std::chrono::steady_clock::now ();
+      for (uint32_t span : changed)
+        {
+          for (uint32_t id : qot.GetSpanLightpaths (span))
+            {
+              referenceSnrSum += qot.RecomputeSnrDb (id);
+              ++referenceCount;
+            }
+        }
+      recomputeSeconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - naiveStart).count ();
+      if (remove)
+        {
+          std::chrono::steady_clock::time_point removeStart = std::chrono::steady_clock::now ();
+          qot.RemoveLightpath (active.front ().first);
+          incrementalSeconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - removeStart).count ();
+          occupancy.Release (active.front ().second.first, active.front ().second.second, 1);
+          litUnits -= active.front ().second.first.size ();
+          active.pop_front ();
+          continue;
+        }
+      occupancy.FreeOnPath (path, &free[0]);
+      uint32_t channel = SpectrumOccupancy::FirstFreeBlock (&free[0], occupancy.GetWords (), 1);
+      if (channel >= channels)
+        {
+          continue;
+        }
+      occupancy.Occupy (path, channel, 1);
+      litUnits += path.size ();
+      std::chrono::steady_clock::time_point addStart = std::chrono::steady_clock::now ();
+      uint32_t id = qot.AddLightpath (path, channel, 0);
+      incrementalSeconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - addStart).count ();
+      active.push_back (std::make_pair (id, std::make_pair (path, channel)));
+    }
+  double maxErrorDb = 0.0;
+  for (const std::pair<uint32_t, std::pair<std::vector<uint32_t>, uint32_t> > &lightpath : active)
+    {
+      maxErrorDb = std::max (maxErrorDb, std::fabs (qot.GetSnrDb (lightpath.first) - qot.RecomputeSnrDb (lightpath.first)));
+    }
+  NS_LOG_UNCOND ("QoT updates, " << spans << " spans x " << channels << " channels, " << active.size ()
+                                 << " lightpaths up at the end");
+  NS_LOG_UNCOND ("  incremental " << incrementalSeconds * 1e6 / changes << " us per change, full recompute of the "
+                                  << "affected lightpaths " << recomputeSeconds * 1e6 / changes << " us ("
+                                  << recomputeSeconds / incrementalSeconds << "x); max SNR difference "
+                                  << maxErrorDb << " dB (mean reference SNR "
+                                  << (referenceCount > 0 ? referenceSnrSum / referenceCount : 0.0) << " dB)");
+}
+
+// GN-model NLI over all channel pairs of one span, 96 and 192 channels: the scalar std::asinh reference
+// against the vector kernel, and the largest relative difference between them
+void
+RunGnNliBenchmark ()
+{
+  QotEngine::SpanParameters p = QotEngine::SpanParameters::Default ();
+  GnSpanConstants c = GnSpanConstants::From (p.lengthKm, p.alphaDbPerKm, p.gammaPerWattKm, p.beta2Ps2PerKm);
+  Xoshiro256ppRng random;
+  random.BeginPacket (3, 0);
+  NS_LOG_UNCOND ("GN-model NLI, one span, all channel pairs, us per span");
+  uint32_t counts[] = {96, 192};
+  for (uint32_t n : counts)
+    {
+      GnChannels ch;
+      ch.Resize (n);
+      for (uint32_t i = 0; i < n; ++i)
+        { // 50 GHz grid, 32 or 40 GBd, launch power 0 dBm +/- 1 dB
+          ch.frequencyHz[i] = p.centreFrequencyHz + (i - 0.5 * n) * p.spacingHz;
+          ch.bandwidthHz[i] = random.Uniform () < 0.5 ? 32e9 : 40e9;
+          ch.powerW[i] = 1e-3 * std::pow (10.0, (random.Uniform () * 2.0 - 1.0) / 10.0);
+        }
+      std::vector<double> reference (n);
+      std::vector<double> vectorised (n);
+      uint32_t spans = 2000;
+      double scalarUs = NanosecondsPerCall ([&] (uint32_t) { GnNliScalar (c, ch, &reference[0]); }, spans) / 1e3;
+      double vectorUs = NanosecondsPerCall ([&] (uint32_t) { GnNliVector (c, ch, &vectorised[0]); }, spans) / 1e3;
+      double maxError = 0.0;
+      for (uint32_t i = 0; i < n; ++i)
+        {
+          maxError = std::max (maxError, std::fabs (vectorised[i] / reference[i] - 1.0));
+        }
+      NS_LOG_UNCOND ("  " << n << " channels: scalar " << scalarUs << ", vector " << vectorUs << " ("
+                          << scalarUs / vectorUs << "x), max relative difference " << maxError);
+    }
+}
+
+// Sends count packets of the given size from dev, one every interval
+void
+SendLightpathPackets (Ptr<WdmNetDevice> dev, Address dest, uint32_t size, uint32_t count, Time interval)
+{
+  dev->Send (Create<Packet> (size), dest, 0x0800);
+  if (count > 1)
+    {
+      Simulator::Schedule (interval, &SendLightpathPackets, dev, dest, size, count - 1, interval);
+    }
+}
+
+// A transparent lightpath over ROADM hops of amplified spans, decided per hop (every hop draws against its
+// own SNR) and through OpticalImpairmentTag (noise summed, one draw at the endpoint), against the
+// analytical end-to-end loss. Then the same lightpath carries packets between two devices on a fiber,
+// once with the tag chain on the wavelength and once without it, and the two losses are compared.
+void
+RunLightpathTagBenchmark ()
+{
+  const uint32_t hops = 8;
+  const uint32_t packets = 200000;
+  const uint32_t size = 1024;
+  const DataRate rate (100000000000ULL); // 100G DP-QPSK
+  AmplifiedLink::Span span = {100.0, 0.2, 0.0, 0.0, 5.0};
+  AmplifiedLink hopLink; // 4 x 100 km between ROADMs
+  hopLink.AddSpans (4, span);
+  hopLink.SetLaunchPowerDbm (-3.0);
+
+  std::vector<Ptr<OpticalErrorModel> > perHop (hops);
+  std::vector<Ptr<OpticalErrorModel> > tagged (hops);
+  for (uint32_t h = 0; h < hops; ++h)
+    {
+      perHop[h] = CreateObject<OpticalErrorModel> ();
+      perHop[h]->SetWavelengthId (h);
+      perHop[h]->SetCorruptMode (OpticalErrorModel::CLOSED_FORM); // 8192 draws per packet and hop would swamp the timing
+      hopLink.Apply (perHop[h], DP_QPSK, rate);
+      tagged[h] = CreateObject<OpticalErrorModel> ();
+      tagged[h]->SetWavelengthId (hops + h);
+      tagged[h]->SetCorruptMode (OpticalErrorModel::CLOSED_FORM);
+      hopLink.Apply (tagged[h], DP_QPSK, rate);
+      tagged[h]->SetLightpathRole (h + 1 < hops ? OpticalErrorModel::TRANSIT : OpticalErrorModel::TERMINATION);
+    }
+  double hopSnrDb = perHop[0]->GetSnrDb ();
+  double pathSnrDb = hopSnrDb - 10.0 * std::log10 (static_cast<double> (hops));
+  double pathBer = QFunctionTable::Get ().BerFromSnrDb (DP_QPSK, pathSnrDb);
+  double expected = -std::expm1 (size * 8.0 * std::log1p (-pathBer));
+
+  uint64_t perHopLost = 0;
+  double perHopNs = NanosecondsPerCall ([&] (uint32_t) {
+    Ptr<Packet> p = Create<Packet> (size);
+    for (uint32_t h = 0; h < hops; ++h)
       {
-        if (m_random->GetValue () < m_ber) // A random number is generated for each bit, and if it's less, corrupt the packet
+        if (perHop[h]->IsCorrupt (p))
           {
-            return true; // Corrupt the packet
+            ++perHopLost;
+            break;
           }
       }
-    return false; // Not corrupted
-  }
+  }, packets);
+  uint64_t taggedLost = 0;
+  double taggedNs = NanosecondsPerCall ([&] (uint32_t) {
+    Ptr<Packet> p = Create<Packet> (size);
+    for (uint32_t h = 0; h < hops; ++h)
+      {
+        taggedLost += tagged[h]->IsCorrupt (p);
+      }
+  }, packets);
 
-  virtual void DoReset () override {}
+  NS_LOG_UNCOND ("Transparent lightpath, " << hops << " ROADM hops of 4 x 100 km, " << size << " B packets");
+  NS_LOG_UNCOND ("  hop SNR " << hopSnrDb << " dB, end-to-end SNR " << pathSnrDb << " dB, expected loss " << expected);
+  NS_LOG_UNCOND ("  per-hop draws: loss " << static_cast<double> (perHopLost) / packets << ", " << perHopNs
+                                          << " ns per packet");
+  NS_LOG_UNCOND ("  impairment tag: loss " << static_cast<double> (taggedLost) / packets << ", " << taggedNs
+                                           << " ns per packet, " << tagged[hops - 1]->GetCounters ().packetsInspected
+                                           << " decisions");
 
-  Ptr<UniformRandomVariable> m_random; // RNG for the corruption
-  double m_ber; // BER
-  double m_snrDb; // SNR
-};
+  // Device path: the hops before the receiver are TRANSIT models on the wavelength, the receiver a
+  // TERMINATION model; without the tag the receiver alone draws against the end-to-end SNR
+  NodeContainer nodes;
+  nodes.Create (2);
+  Ptr<WdmFiberChannel> fiber = CreateObject<WdmFiberChannel> ();
+  Ptr<WdmNetDevice> ends[2];
+  for (uint32_t end = 0; end < 2; ++end)
+    {
+      ends[end] = CreateObject<WdmNetDevice> ();
+      ends[end]->SetAddress (Mac48Address::Allocate ());
+      ends[end]->SetDataRate (rate);
+      nodes.Get (end)->AddDevice (ends[end]);
+    }
+  uint32_t lambda = fiber->AddWavelength (ends[0], ends[1], MicroSeconds (400 * hops));
+  std::vector<Ptr<OpticalErrorModel> > transit (hops - 1);
+  for (uint32_t h = 0; h + 1 < hops; ++h)
+    {
+      transit[h] = CreateObject<OpticalErrorModel> ();
+      transit[h]->SetWavelengthId (2 * hops + h);
+      hopLink.Apply (transit[h], DP_QPSK, rate);
+      transit[h]->SetLightpathRole (OpticalErrorModel::TRANSIT);
+    }
+  Ptr<OpticalErrorModel> termination = CreateObject<OpticalErrorModel> ();
+  termination->SetWavelengthId (3 * hops);
+  termination->SetCorruptMode (OpticalErrorModel::CLOSED_FORM);
+  hopLink.Apply (termination, DP_QPSK, rate);
+  termination->SetLightpathRole (OpticalErrorModel::TERMINATION);
+  Ptr<OpticalErrorModel> endToEnd = CreateObject<OpticalErrorModel> ();
+  endToEnd->SetWavelengthId (3 * hops + 1);
+  endToEnd->SetCorruptMode (OpticalErrorModel::CLOSED_FORM);
+  endToEnd->SetSnrDriven (true, DP_QPSK);
+  endToEnd->SetSnrDb (pathSnrDb);
+
+  Time interval = rate.CalculateBytesTxTime (2 * size); // Well below the line rate: no queue drops
+  fiber->SetTransitErrorModels (lambda, ends[1], transit);
+  ends[1]->SetReceiveErrorModel (termination);
+  SendLightpathPackets (ends[0], ends[1]->GetAddress (), size, packets, interval);
+  Simulator::Run ();
+  OpticalErrorModel::Counters withTag = termination->GetCounters ();
+  fiber->SetTransitErrorModels (lambda, ends[1], std::vector<Ptr<OpticalErrorModel> > ());
+  ends[1]->SetReceiveErrorModel (endToEnd);
+  SendLightpathPackets (ends[0], ends[1]->GetAddress (), size, packets, interval);
+  Simulator::Run ();
+  OpticalErrorModel::Counters withoutTag = endToEnd->GetCounters ();
+  Simulator::Destroy ();
+
+  double lossWith = withTag.packetsInspected > 0 ? static_cast<double> (withTag.packetsCorrupted) / withTag.packetsInspected : 0.0;
+  double lossWithout = withoutTag.packetsInspected > 0
+                           ? static_cast<double> (withoutTag.packetsCorrupted) / withoutTag.packetsInspected : 0.0;
+  double sigma = std::sqrt ((lossWith * (1.0 - lossWith) + lossWithout * (1.0 - lossWithout)) / packets);
+  bool agree = withTag.packetsInspected == packets && withoutTag.packetsInspected == packets
+               && std::fabs (lossWith - lossWithout) <= 4.0 * sigma;
+  NS_LOG_UNCOND ("  device lightpath: loss " << lossWith << " with the tag, " << lossWithout << " without ("
+                                             << withTag.packetsInspected << " / " << withoutTag.packetsInspected
+                                             << " packets received), " << (agree ? "agree" : "DISAGREE")
+                                             << " within 4 sigma (" << 4.0 * sigma << ")");
+}
 
 // ------------------ Main Simulation ------------------
 NS_LOG_COMPONENT_DEFINE ("WdmOpticalAsymmetricExample");
@@ -71,60 +4719,462 @@ NS_LOG_COMPONENT_DEFINE ("WdmOpticalAsymmetricExample");
 int 
 main (int argc, char *argv[])
 {
-  // These are default values; we will override them manually for each wavelength.
-  uint32_t maxPackets = 1000;
-  double interval     = 0.01;
-  uint32_t packetSize = 1024;
+  // Traffic overrides for every wavelength; 0 keeps each wavelength's scenario profile.
+  uint32_t maxPackets = 0;
+  double interval     = 0.0;
+  uint32_t packetSize = 0;
+  std::string errorMode = "perbit"; // "perbit" (one draw per bit, the original loop), "closed" (one draw per packet) or "geometric" (error positions)
+  bool flipBits = false;
+  bool snrDriven = false; // Derive each wavelength's BER from its SNR instead of using the fixed BER values
+  std::string modulation = "dpqpsk"; // "ook", "dpqpsk" or "16qam"
+  bool burst = false; // Gilbert-Elliott burst errors on top of each wavelength's BER
+  double burstBadBer = 1e-4; // BER while in a burst
+  double burstMeanGood = 1.0; // Mean time (s) between bursts
+  double burstMeanBad = 0.01; // Mean burst duration (s)
+  std::string traceFile = ""; // Per-wavelength trace prefix: wavelength i reads <traceFile>-<i>.bin
+  std::string traceKind = "ber"; // "ber" or "snr" (dB)
+  std::string fec = "none"; // "none", "rs" (RS(255,239)) or "sd" (20% SD-FEC)
+  double fecLatencyUs = -1.0; // FEC decoder latency in microseconds (negative: the code's default)
+  std::string rng = "mrg"; // "mrg" (ns-3 MRG32k3a stream), "philox", "xoshiro" or "simd" (per-packet streams)
+  bool benchErrorModel = false; // Run the per-bit RNG microbenchmark and exit
+  bool checkRng = false; // Check the RNG policies and exit
+  double isBias = 1.0; // Importance-sampling BER bias (1 = off)
+  bool sharedFiber = false; // Carry all wavelengths over one WdmFiberChannel instead of one p2p link each
+  std::string scenario = ""; // CSV with one line per wavelength (empty: the built-in two-wavelength table)
+  std::string stripe = "none"; // "none" (one subnet per wavelength), "packet", "flowlet" or "latency" (one bonded interface)
+  std::string topology = ""; // "ring" or "mesh": build a ROADM network instead of the two-node scenario
+  uint32_t roadmNodes = 100; // ROADMs in the ring/mesh
+  uint32_t lambdasPerFiber = 40; // Wavelengths on every span
+  Time spanDelay = MicroSeconds (400); // One span (~80 km)
+  uint32_t rwaRequests = 0; // Lightpath requests to route over the ROADM network (0: build report only)
+  uint32_t rwaLoad = 1000; // Lightpaths kept up at once; the oldest is torn down for each new request
+  uint32_t kPaths = 3; // Alternate routes per node pair
+  std::string rwa = "firstfit"; // Wavelength assignment: firstfit or mostused
+  bool flexgrid = false; // ROADM spans use 12.5 GHz slots instead of fixed wavelengths
+  uint32_t slotsPerFiber = 320; // Flexgrid slots per span (320 ~ C-band, 768 ~ C+L)
+  bool benchFlexgrid = false; // Run the flexgrid allocation microbenchmark and exit
+  double erlangs = 0.0; // Offered lightpath load on the ROADM network (0: no dynamic lightpaths)
+  Time holdingTime = Seconds (100); // Mean lightpath lifetime
+  uint32_t lightpathRequests = 100000; // Lightpath arrivals to simulate with --erlangs
+  bool qot = false; // Dynamic lightpaths get their SNR from the incremental GN-model engine
+  bool benchQot = false; // Time incremental vs full QoT recomputation and exit
+  bool benchGnNli = false; // Time the GN-model NLI kernels and exit
+  bool benchLightpathTag = false; // Compare per-hop and end-to-end error decisions on a lightpath and exit
+  uint32_t spans = 0; // Amplified spans per wavelength (0: use the scenario's BER/SNR constants)
+  double spanLengthKm = 80.0; // Length of each span
+  double edfaNoiseFigureDb = 5.0; // Inline EDFA noise figure
+  double launchPowerDbm = 0.0; // Per-channel launch power
+  bool monteCarlo = false; // --erlangs without the ns-3 scheduler: blocking and utilisation only
+  bool resequence = true; // Striped runs: restore packet order at the receiving bond
+  Time resequenceTimeout = MilliSeconds (10); // How long a lost packet may hold back the ones behind it
 
   CommandLine cmd;
-  cmd.AddValue ("maxPackets", "Number of packets each client sends", maxPackets);
-  cmd.AddValue ("interval", "Interval (seconds) between packets", interval);
-  cmd.AddValue ("packetSize", "Size of each packet (bytes)", packetSize);
+  cmd.AddValue ("maxPackets", "Number of packets each client sends (0: per-wavelength scenario value)", maxPackets);
+  cmd.AddValue ("interval", "Interval (seconds) between packets (0: per-wavelength scenario value)", interval);
+  cmd.AddValue ("packetSize", "Size of each packet (bytes) (0: per-wavelength scenario value)", packetSize);
+  cmd.AddValue ("errorMode", "Error model decision: perbit (one draw per bit, the default), closed (one draw per packet) or geometric (skip-ahead error positions)", errorMode);
+  cmd.AddValue ("flipBits", "With errorMode=geometric, flip the errored bits in the packet buffer", flipBits);
+  cmd.AddValue ("snrDriven", "Derive the BER from each wavelength's SNR instead of the fixed BER values", snrDriven);
+  cmd.AddValue ("modulation", "Modulation format for snrDriven: ook, dpqpsk or 16qam", modulation);
+  cmd.AddValue ("burst", "Enable Gilbert-Elliott burst errors (the wavelength's BER is the good-state BER)", burst);
+  cmd.AddValue ("burstBadBer", "BER while in a burst", burstBadBer);
+  cmd.AddValue ("burstMeanGood", "Mean time (s) spent in the good state", burstMeanGood);
+  cmd.AddValue ("burstMeanBad", "Mean burst duration (s)", burstMeanBad);
+  cmd.AddValue ("traceFile", "Replay BER/SNR traces: wavelength i maps <traceFile>-<i>.bin (time, value) records", traceFile);
+  cmd.AddValue ("traceKind", "What the trace values are: ber or snr (dB)", traceKind);
+  cmd.AddValue ("fec", "FEC applied to the channel BER: none, rs (RS(255,239)) or sd (20% SD-FEC)", fec);
+  cmd.AddValue ("fecLatency", "FEC decoder latency in microseconds, added to each link delay when --fec is set (default: per code)", fecLatencyUs);
+  cmd.AddValue ("rng", "Error model RNG: mrg (ns-3 default), philox, xoshiro or simd (inlined, keyed by run/wavelength/packet)", rng);
+  cmd.AddValue ("benchErrorModel", "Run the per-bit error decision microbenchmark and exit", benchErrorModel);
+  cmd.AddValue ("checkRng", "Check the Philox and xoshiro RNGs against known answers and the SIMD stream positions, and exit", checkRng);
+  cmd.AddValue ("isBias", "Importance sampling: corrupt as if the BER were this many times higher and report unbiased loss estimates (1 = off)", isBias);
+  cmd.AddValue ("sharedFiber", "Carry all wavelengths over one shared WdmFiberChannel instead of one point-to-point link each", sharedFiber);
+  cmd.AddValue ("stripe", "Bond all wavelengths into one interface: none, packet (per-packet), flowlet or latency (earliest delivery)", stripe);
+  cmd.AddValue ("resequence", "Reorder striped packets at the receiving node", resequence);
+  cmd.AddValue ("resequenceTimeout", "Give up on a missing striped packet after this long", resequenceTimeout);
+  cmd.AddValue ("topology", "Build a ROADM network instead of two nodes: ring or mesh", topology);
+  cmd.AddValue ("roadmNodes", "Number of ROADM nodes in the ring/mesh", roadmNodes);
+  cmd.AddValue ("lambdasPerFiber", "Wavelengths per fiber span in the ring/mesh", lambdasPerFiber);
+  cmd.AddValue ("spanDelay", "Propagation delay of one fiber span (with --scenario, each lambda uses its row's delay)", spanDelay);
+  cmd.AddValue ("rwaRequests", "Random lightpath requests to route over the ROADM network", rwaRequests);
+  cmd.AddValue ("rwaLoad", "Lightpaths kept up at once during --rwaRequests", rwaLoad);
+  cmd.AddValue ("kPaths", "Alternate shortest paths tried per lightpath request", kPaths);
+  cmd.AddValue ("rwa", "Wavelength assignment: firstfit or mostused", rwa);
+  cmd.AddValue ("flexgrid", "Allocate contiguous 12.5 GHz slots per lightpath instead of one wavelength", flexgrid);
+  cmd.AddValue ("slotsPerFiber", "Flexgrid slots per fiber span", slotsPerFiber);
+  cmd.AddValue ("benchFlexgrid", "Time flexgrid slot allocation at 320 and 768 slots and exit", benchFlexgrid);
+  cmd.AddValue ("erlangs", "Offered dynamic lightpath load on the ROADM network, in Erlang (blocking and spectrum occupancy only: lightpaths create no devices and carry no traffic)", erlangs);
+  cmd.AddValue ("holdingTime", "Mean lightpath holding time (exponential)", holdingTime);
+  cmd.AddValue ("lightpathRequests", "Lightpath arrivals to simulate with --erlangs", lightpathRequests);
+  cmd.AddValue ("monteCarlo", "Run --erlangs as a flow-free Monte Carlo (no stack, applications or FlowMonitor)", monteCarlo);
+  cmd.AddValue ("qot", "Feed each dynamic lightpath's error model from the GN-model QoT engine", qot);
+  cmd.AddValue ("benchQot", "Time incremental QoT updates at 96 channels x 1000 spans and exit", benchQot);
+  cmd.AddValue ("benchGnNli", "Time the scalar and vector GN-model NLI kernels at 96/192 channels and exit", benchGnNli);
+  cmd.AddValue ("benchLightpathTag", "Compare per-hop and tagged end-to-end error decisions on a transparent lightpath and exit", benchLightpathTag);
+  cmd.AddValue ("spans", "Amplified spans per wavelength; the BER comes from the accumulated OSNR (0: scenario BER/SNR)", spans);
+  cmd.AddValue ("spanLengthKm", "Length of each amplified span (km)", spanLengthKm);
+  cmd.AddValue ("edfaNf", "Noise figure of the inline EDFAs (dB)", edfaNoiseFigureDb);
+  cmd.AddValue ("launchPowerDbm", "Per-channel launch power (dBm)", launchPowerDbm);
+  cmd.AddValue ("scenario", "CSV wavelength table: dataRate,delay,ber,snrDb,maxPackets,interval,packetSize[,start] per line", scenario);
+
+  // Wall-clock time of the setup, to keep large wavelength tables honest
+  std::chrono::steady_clock::time_point setupStart = std::chrono::steady_clock::now ();
+
+  // Per-wavelength link, BER/SNR and traffic settings. The table decides which --wl<i>.* overrides
+  // exist, so it is loaded before the command line is parsed.
+  scenario = PeekArgument (argc, argv, "scenario");
+  std::vector<WavelengthConfig> wavelengths = scenario.empty () ? ScenarioConfig::Default ()
+                                                                : ScenarioConfig::LoadCsv (scenario);
+  std::vector<uint32_t> wlMaxPackets (wavelengths.size (), 0); // --wl<i>.maxPackets, 0 = not given
+  std::vector<double> wlInterval (wavelengths.size (), 0.0); // --wl<i>.interval
+  std::vector<uint32_t> wlPacketSize (wavelengths.size (), 0); // --wl<i>.packetSize
+  std::vector<uint32_t> wlSpans (wavelengths.size (), 0); // --wl<i>.spans
+  for (uint32_t i = 0; i < wavelengths.size (); i++)
+    {
+      std::ostringstream prefix;
+      prefix << "wl" << i << ".";
+      cmd.AddValue (prefix.str () + "maxPackets", "Packets sent on this wavelength (overrides maxPackets)", wlMaxPackets[i]);
+      cmd.AddValue (prefix.str () + "interval", "Interval (seconds) on this wavelength (overrides interval)", wlInterval[i]);
+      cmd.AddValue (prefix.str () + "packetSize", "Packet size (bytes) on this wavelength (overrides packetSize)", wlPacketSize[i]);
+      cmd.AddValue (prefix.str () + "spans", "Amplified spans on this wavelength (overrides spans)", wlSpans[i]);
+    }
   cmd.Parse (argc, argv);
 
+  // Precedence: --wl<i>.x, then the global flag, then the scenario profile
+  for (uint32_t i = 0; i < wavelengths.size (); i++)
+    {
+      TrafficProfile &traffic = wavelengths[i].traffic;
+      uint32_t wlPackets = wlMaxPackets[i] ? wlMaxPackets[i] : maxPackets;
+      double wlGap = wlInterval[i] > 0.0 ? wlInterval[i] : interval;
+      uint32_t wlSize = wlPacketSize[i] ? wlPacketSize[i] : packetSize;
+      if (wlPackets > 0)
+        {
+          traffic.maxPackets = wlPackets;
+        }
+      if (wlGap > 0.0)
+        {
+          traffic.interval = Seconds (wlGap);
+        }
+      if (wlSize > 0)
+        {
+          traffic.packetSize = wlSize;
+        }
+    }
+
+  if (benchErrorModel)
+    {
+      RunErrorModelBenchmark ();
+      return 0;
+    }
+  if (checkRng)
+    {
+      return RunRngSelfCheck () ? 0 : 1;
+    }
+  if (benchFlexgrid)
+    {
+      RunFlexgridBenchmark ();
+      return 0;
+    }
+  if (benchQot)
+    {
+      RunQotBenchmark ();
+      return 0;
+    }
+  if (benchGnNli)
+    {
+      RunGnNliBenchmark ();
+      return 0;
+    }
+  if (benchLightpathTag)
+    {
+      RunLightpathTagBenchmark ();
+      return 0;
+    }
+
+  OpticalErrorModel::CorruptMode corruptMode = OpticalErrorModel::PER_BIT;
+  if (errorMode == "closed")
+    {
+      corruptMode = OpticalErrorModel::CLOSED_FORM;
+    }
+  else if (errorMode == "geometric")
+    {
+      corruptMode = OpticalErrorModel::GEOMETRIC;
+    }
+  else if (errorMode != "perbit")
+    {
+      NS_FATAL_ERROR ("Unknown errorMode '" << errorMode << "' (expected perbit, closed or geometric)");
+    }
+
+  if (traceKind != "ber" && traceKind != "snr")
+    {
+      NS_FATAL_ERROR ("Unknown traceKind '" << traceKind << "' (expected ber or snr)");
+    }
+
+  FecModel::Type fecType = FecModel::NONE;
+  if (fec == "rs")
+    {
+      fecType = FecModel::RS_255_239;
+    }
+  else if (fec == "sd")
+    {
+      fecType = FecModel::SD_FEC;
+    }
+  else if (fec != "none")
+    {
+      NS_FATAL_ERROR ("Unknown fec '" << fec << "' (expected none, rs or sd)");
+    }
+  if (rng != "mrg" && rng != "philox" && rng != "xoshiro" && rng != "simd")
+    {
+      NS_FATAL_ERROR ("Unknown rng '" << rng << "' (expected mrg, philox, xoshiro or simd)");
+    }
+
+  Time fecLatency = fecType == FecModel::NONE ? Seconds (0) // No decoder, no decoding latency
+                   : fecLatencyUs < 0 ? FecModel::DefaultLatency (fecType) : MicroSeconds (fecLatencyUs);
+
+  if (stripe != "none" && stripe != "packet" && stripe != "flowlet" && stripe != "latency")
+    {
+      NS_FATAL_ERROR ("Unknown stripe '" << stripe << "' (expected none, packet, flowlet or latency)");
+    }
+  bool striped = stripe != "none";
+
+  ModulationFormat modulationFormat = DP_QPSK;
+  if (modulation == "ook")
+    {
+      modulationFormat = OOK;
+    }
+  else if (modulation == "16qam")
+    {
+      modulationFormat = QAM16;
+    }
+  else if (modulation != "dpqpsk")
+    {
+      NS_FATAL_ERROR ("Unknown modulation '" << modulation << "' (expected ook, dpqpsk or 16qam)");
+    }
+
+  // ---------- ROADM NETWORK ----------
+  // Span BER comes from the first scenario row; with --scenario, lambda i also takes its line rate and
+  // per-span delay from row i % rows (otherwise the first row's rate and --spanDelay). Reports the build
+  // cost, then optionally routes random lightpath requests over it
+  if (!topology.empty ())
+    {
+      if (topology != "ring" && topology != "mesh")
+        {
+          NS_FATAL_ERROR ("Unknown topology '" << topology << "' (expected ring or mesh)");
+        }
+      if (rwa != "firstfit" && rwa != "mostused")
+        {
+          NS_FATAL_ERROR ("Unknown rwa '" << rwa << "' (expected firstfit or mostused)");
+        }
+      RoadmTopology::Config topoConfig;
+      topoConfig.shape = topology == "ring" ? RoadmTopology::RING : RoadmTopology::MESH;
+      topoConfig.nodes = roadmNodes;
+      topoConfig.wavelengthsPerFiber = flexgrid ? slotsPerFiber : lambdasPerFiber; // Units on every span
+      topoConfig.rate = wavelengths[0].rate;
+      topoConfig.spanDelay = spanDelay;
+      topoConfig.spanBer = wavelengths[0].ber;
+      if (!scenario.empty ())
+        {
+          for (const WavelengthConfig &row : wavelengths)
+            {
+              topoConfig.lambdaRates.push_back (row.rate);
+              topoConfig.lambdaDelays.push_back (row.delay);
+            }
+        }
+      topoConfig.createDevices = rwaRequests == 0 && erlangs <= 0.0; // Routing studies only need the graph
+      RoadmTopology roadm (topoConfig);
+      roadm.Build ();
+      const RoadmTopology::BuildReport &report = roadm.GetReport ();
+      uint64_t lambdas = static_cast<uint64_t> (roadm.GetNSpans ()) * topoConfig.wavelengthsPerFiber;
+      NS_LOG_UNCOND ("Built " << topology << " of " << roadm.GetNNodes () << " ROADMs, " << roadm.GetNSpans ()
+                              << " spans, " << lambdas << " span-lambdas (" << report.devices << " devices) in "
+                              << report.seconds << " s");
+      NS_LOG_UNCOND ("  Memory: " << report.bytes / 1024 << " KiB, "
+                                  << static_cast<double> (report.bytes) / roadm.GetNNodes () << " B per node, "
+                                  << (lambdas > 0 ? static_cast<double> (report.bytes) / lambdas : 0.0)
+                                  << " B per span-lambda");
+      NS_LOG_UNCOND ("  Build time: " << report.seconds * 1e6 / roadm.GetNNodes () << " us per node, "
+                                      << (lambdas > 0 ? report.seconds * 1e9 / lambdas : 0.0) << " ns per span-lambda");
+
+      if (erlangs > 0.0 && roadm.GetNNodes () > 1)
+        { // Dynamic lightpaths: Poisson arrivals at erlangs / holdingTime, exponential holding
+          RwaEngine engine (roadm, kPaths, rwa == "mostused" ? RwaEngine::MOST_USED : RwaEngine::FIRST_FIT);
+          DynamicLightpathManager::Config dynConfig;
+          dynConfig.arrivalRate = erlangs / holdingTime.GetSeconds ();
+          dynConfig.meanHolding = holdingTime;
+          dynConfig.requests = lightpathRequests;
+          dynConfig.warmup = lightpathRequests / 10;
+          dynConfig.batches = 20;
+          for (uint32_t i = 0; i < wavelengths.size (); i++)
+            {
+              dynConfig.widths.push_back (flexgrid ? FlexgridSlots (wavelengths[i].rate, modulationFormat) : 1);
+            }
+          if (monteCarlo)
+            { // Only the lightpath process against the spectrum state; nothing else is built
+              MonteCarloBlocking::Result mc = MonteCarloBlocking (roadm, engine, dynConfig).Run ();
+              NS_LOG_UNCOND ("Monte Carlo RWA (" << erlangs << " Erlang): blocking " << mc.blocking.probability
+                                                 << " +/- " << mc.blocking.ci95 << " (95% CI, " << mc.blocking.requests
+                                                 << " requests after warm-up), spectrum utilisation "
+                                                 << mc.utilisation * 100.0 << "%");
+              NS_LOG_UNCOND ("  " << lightpathRequests << " requests in " << mc.seconds << " s ("
+                                  << lightpathRequests / mc.seconds << " per second)");
+              Simulator::Destroy ();
+              return 0;
+            }
+          DynamicLightpathManager manager (roadm, engine, dynConfig);
+          std::unique_ptr<QotEngine> qotEngine; // Only with --qot: it holds spans x channels of NLI state
+          if (qot)
+            {
+              qotEngine.reset (new QotEngine (roadm.GetNSpans (), topoConfig.wavelengthsPerFiber,
+                                              QotEngine::SpanParameters::Default ()));
+              manager.SetQot (qotEngine.get ());
+            }
+          manager.Start ();
+          std::chrono::steady_clock::time_point dynStart = std::chrono::steady_clock::now ();
+          Simulator::Run ();
+          double dynSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - dynStart).count ();
+          BlockingEstimate blocking = manager.GetBlocking ();
+          NS_LOG_UNCOND ("Dynamic lightpaths (" << erlangs << " Erlang, mean holding " << holdingTime.GetSeconds ()
+                                                << " s): blocking " << blocking.probability << " +/- " << blocking.ci95
+                                                << " (95% CI, " << blocking.requests << " requests after warm-up)");
+          NS_LOG_UNCOND ("  Peak " << manager.GetPeakActive () << " lightpaths up, " << lightpathRequests / dynSeconds
+                                   << " requests per second of wall time");
+          if (qot)
+            {
+              NS_LOG_UNCOND ("  QoT: mean SNR at setup " << manager.GetMeanSetupSnrDb () << " dB, "
+                                                        << qotEngine->GetChannelUpdates () << " per-channel updates");
+            }
+        }
+
+      if (rwaRequests > 0 && roadm.GetNNodes () > 1)
+        {
+          RwaEngine engine (roadm, kPaths, rwa == "mostused" ? RwaEngine::MOST_USED : RwaEngine::FIRST_FIT);
+          std::deque<RwaEngine::Lightpath> active; // Oldest first
+          Xoshiro256ppRng random;
+          random.BeginPacket (RngSeedManager::GetSeed (), RngSeedManager::GetRun ());
+          uint32_t n = roadm.GetNNodes ();
+          std::chrono::steady_clock::time_point rwaStart = std::chrono::steady_clock::now ();
+          for (uint32_t r = 0; r < rwaRequests; r++)
+            {
+              if (active.size () >= rwaLoad && !active.empty ())
+                {
+                  engine.Release (active.front ());
+                  active.pop_front ();
+                }
+              uint32_t src = static_cast<uint32_t> (random.Next () % n);
+              uint32_t dst = static_cast<uint32_t> (random.Next () % (n - 1));
+              dst += dst >= src ? 1 : 0; // Any node but src
+              // Flexgrid: the lightpath takes the slots its rate and modulation need (scenario rows in turn)
+              uint32_t width = flexgrid ? FlexgridSlots (wavelengths[r % wavelengths.size ()].rate, modulationFormat) : 1;
+              RwaEngine::Lightpath lightpath;
+              if (engine.Setup (src, dst, width, lightpath))
+                {
+                  active.push_back (lightpath);
+                }
+            }
+          double rwaSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - rwaStart).count ();
+          const RwaEngine::Stats &rwaStats = engine.GetStats ();
+          NS_LOG_UNCOND ("RWA (" << (flexgrid ? "flexgrid first-fit" : rwa.c_str ()) << ", k=" << kPaths << ", " << rwaLoad << " lightpaths up): "
+                                 << rwaStats.requests << " requests, " << rwaStats.blocked << " blocked ("
+                                 << static_cast<double> (rwaStats.blocked) / rwaStats.requests << "), "
+                                 << rwaStats.requests / rwaSeconds * 60.0 << " requests per minute");
+        }
+      Simulator::Destroy ();
+      return 0;
+    }
+
   // Create 2 nodes
   NodeContainer nodes; // 'NodeContainer' is an NS3 network container that simulate nodes
   nodes.Create (2); // Create two nodes
 
-  // We'll model two WDM wavelengths as two separate point-to-point channels
-  uint32_t numWavelengths = 2; // Define number of wavelength (two in this example script)
+  // We'll model each WDM wavelength as a separate point-to-point channel (or one lambda of a shared fiber)
+  uint32_t numWavelengths = static_cast<uint32_t> (wavelengths.size ()); // One wavelength per table row
   // 'PointToPointHelper' is a helper class that is specific to NS3 that helps create point-to-point links
   std::vector<PointToPointHelper> wdmHelpers (numWavelengths); // We create an object of type PointToPointHelper for each wavelength
+  WdmFiberHelper fiberHelper (nodes.Get (0), nodes.Get (1)); // With sharedFiber, one fiber carries every wavelength
+  // Amplified links, one per distinct span count, computed once and shared by the wavelengths using it
+  std::map<uint32_t, AmplifiedLink> amplifiedLinks;
+  AmplifiedLink::Span spanTemplate;
+  spanTemplate.lengthKm = spanLengthKm;
+  spanTemplate.alphaDbPerKm = 0.2;
+  spanTemplate.extraLossDb = 0.0;
+  spanTemplate.gainDb = 0.0; // Gain = span loss
+  spanTemplate.noiseFigureDb = edfaNoiseFigureDb;
+
   NetDeviceContainer allDevices; // 'NetDeviceContainer' hols network devices (e.g., NIC) installed in the node
+  std::vector<Ptr<OpticalErrorModel> > errorModels; // Receiver-side error model of each wavelength
 
   // We loop through each wavelengths to configure the properties
   for (uint32_t i = 0; i < numWavelengths; i++)
     {
       // ---------- ASYMMETRIC LINK ATTRIBUTES ----------
-      if (i == 0)
+      const WavelengthConfig &config = wavelengths[i];
+      DataRate rate = config.rate; // Set the data rate for the link
+      Time delay = config.delay + fecLatency; // Set the propagation delay for the link; FEC decoding adds to it
+      wdmHelpers[i].SetDeviceAttribute ("DataRate", DataRateValue (rate));
+      wdmHelpers[i].SetChannelAttribute ("Delay", TimeValue (delay));
+
+      // Install the point-to-point link (wavelength) on the nodes, or add the wavelength to the shared fiber
+      NetDeviceContainer devices = sharedFiber ? fiberHelper.AddWavelength (rate, delay)
+                                               : wdmHelpers[i].Install (nodes); // So, now 'NetDeviceContainer' containes the network devices- 
+                                                                                //-created on each node for the link
+      // ---------- HIGHER & DISTINCT BER/SNR ----------
+      Ptr<OpticalErrorModel> em;
+      if (rng == "philox")
         {
-          // Wavelength 1
-          wdmHelpers[i].SetDeviceAttribute ("DataRate", StringValue ("10Gbps")); // Set the data rate for the link
-          wdmHelpers[i].SetChannelAttribute ("Delay", StringValue ("2ms")); // Set the propagation delay for the link
+          em = CreateObject<OpticalErrorModelRng<PhiloxRng> > ();
         }
-      else
+      else if (rng == "xoshiro")
         {
-          // Wavelength 2
-          wdmHelpers[i].SetDeviceAttribute ("DataRate", StringValue ("5Gbps"));
-          wdmHelpers[i].SetChannelAttribute ("Delay", StringValue ("5ms"));
+          em = CreateObject<OpticalErrorModelRng<Xoshiro256ppRng> > ();
         }
-
-      // Install the point-to-point link (wavelength) on the nodes
-      NetDeviceContainer devices = wdmHelpers[i].Install (nodes); // So, now 'NetDeviceContainer' containes the network devices- 
-                                                                  //-created on each node for the link
-      // ---------- HIGHER & DISTINCT BER/SNR ----------
-      Ptr<OpticalErrorModel> em = CreateObject<OpticalErrorModel> ();
-      if (i == 0) // Configuring distinct BER and SNR values for each wavelength
+      else if (rng == "simd")
         {
-          em->SetBer (1e-7);    // Wavelength 0: 1e-7
-          em->SetSnrDb (25.0); // e.g., 25 dB
+          em = CreateObject<OpticalErrorModelRng<SimdXoshiroRng> > ();
         }
       else
         {
-          em->SetBer (1e-6);    // Wavelength 1: 1e-6
-          em->SetSnrDb (30.0);  // e.g., 30 dB
+          em = CreateObject<OpticalErrorModel> ();
+        }
+      em->SetWavelengthId (i);
+      em->SetCorruptMode (corruptMode);
+      em->SetFec (fecType);
+      em->SetFlipBits (flipBits);
+      em->SetBer (config.ber); // Configuring distinct BER and SNR values for each wavelength
+      em->SetSnrDb (config.snrDb);
+      if (snrDriven || (!traceFile.empty () && traceKind == "snr")) // SNR traces need the modulation format too
+        {
+          em->SetSnrDriven (true, modulationFormat); // Replaces the fixed BER with the one the SNR implies
+        }
+      uint32_t linkSpans = wlSpans[i] ? wlSpans[i] : spans;
+      if (linkSpans > 0)
+        { // The receiver SNR of an EDFA chain replaces the scenario constants
+          std::map<uint32_t, AmplifiedLink>::iterator link = amplifiedLinks.find (linkSpans);
+          if (link == amplifiedLinks.end ())
+            {
+              link = amplifiedLinks.insert (std::make_pair (linkSpans, AmplifiedLink ())).first;
+              link->second.AddSpans (linkSpans, spanTemplate);
+              link->second.SetLaunchPowerDbm (launchPowerDbm);
+            }
+          link->second.Apply (em, modulationFormat, rate);
+          NS_LOG_UNCOND ("Wavelength " << i << ": " << linkSpans << " x " << spanLengthKm << " km spans, OSNR "
+                                       << link->second.GetOsnrDb () << " dB (0.1 nm), SNR " << em->GetSnrDb ()
+                                       << " dB, pre-FEC BER " << em->GetBer ());
+        }
+      if (!traceFile.empty ())
+        {
+          std::ostringstream tracePath;
+          tracePath << traceFile << "-" << i << ".bin";
+          em->SetTrace (Create<OpticalTrace> (tracePath.str (),
+                                              traceKind == "snr" ? OpticalTrace::SNR_DB : OpticalTrace::BER));
+        }
+      if (burst)
+        {
+          em->SetBurstModel (em->GetBer (), burstBadBer, 1.0 / burstMeanGood, 1.0 / burstMeanBad);
         }
 
+      em->SetImportanceSampling (isBias);
+      errorModels.push_back (em);
+
       // Attach error model to device at node 1 (receiver side)
       devices.Get (1)->SetAttribute ("ReceiveErrorModel", PointerValue (em));
 
@@ -132,16 +5182,46 @@ main (int argc, char *argv[])
       allDevices.Add (devices);
     }
 
+  // ---------- WAVELENGTH STRIPING ----------
+  // With striping, each node gets one bond over its wavelength devices and only the bonds get IP addresses
+  std::vector<Ptr<WdmBondNetDevice> > bonds;
+  if (striped)
+    {
+      for (uint32_t n = 0; n < 2; n++)
+        {
+          Ptr<WdmBondNetDevice> bond = CreateObject<WdmBondNetDevice> ();
+          bond->SetAttribute ("Resequence", BooleanValue (resequence));
+          bond->SetAttribute ("ResequenceTimeout", TimeValue (resequenceTimeout));
+          bond->SetAddress (Mac48Address::Allocate ());
+          bond->SetPolicy (stripe == "flowlet" ? WdmBondNetDevice::FLOWLET
+                           : stripe == "latency" ? WdmBondNetDevice::LOWEST_LATENCY : WdmBondNetDevice::PER_PACKET);
+          nodes.Get (n)->AddDevice (bond);
+          for (uint32_t i = 0; i < numWavelengths; i++)
+            {
+              // Only node 1 has receive error models, so only node 0's choice depends on error rates
+              bond->AddSlave (allDevices.Get (2*i + n), wavelengths[i].rate, wavelengths[i].delay + fecLatency,
+                              n == 0 ? errorModels[i] : 0);
+            }
+          bonds.push_back (bond);
+        }
+      WdmBondNetDevice::Connect (bonds[0], bonds[1]);
+    }
+
   // Install the Internet stack on both nodes (TCP/IP) for upper-layer protocols like UDP
   InternetStackHelper stack;
   stack.Install (nodes);
 
   // Assign IP addresses for each "wavelength" link
   Ipv4AddressHelper address;
-  for (uint32_t i = 0; i < numWavelengths; i++)
+  if (striped)
+    {
+      address.SetBase ("10.0.0.0", "255.255.255.0"); // One subnet for the bonded interface
+      address.Assign (NetDeviceContainer (bonds[0], bonds[1]));
+    }
+  for (uint32_t i = 0; i < numWavelengths && !striped; i++)
     {
       std::ostringstream subnet; // Creates separate subnets (e.g., 10.1.1.0/24 and 10.1.2.0/24) for each wavelength
-      subnet << "10.1." << (i + 1) << ".0"; // 10.1.1.0 / 10.1.2.0
+      subnet << "10." << (1 + (i + 1) / 256) << "." << ((i + 1) % 256) << ".0"; // 10.1.1.0 / 10.1.2.0 / ...
       address.SetBase (subnet.str ().c_str (), "255.255.255.0");
 
       // Each pair of devices is at indices [2*i, 2*i+1]
@@ -157,60 +5237,59 @@ main (int argc, char *argv[])
   // Then the client is on node 0, sending with different traffic patterns.
 
   uint16_t serverPortBase = 9000;
-
+  // Striped or not, every wavelength's profile is one flow, so the bonded and per-subnet runs offer the
+  // same load and their all-flows p99 delays compare like for like
   for (uint32_t i = 0; i < numWavelengths; i++)
     {
-      // Get the server IP (node 1, interface i+1) 
+      // Get the server IP (node 1, interface i+1; the bond is its only interface when striped)
       Ptr<Ipv4> ipv4Node1 = nodes.Get (1)->GetObject<Ipv4> ();
-      Ipv4Address serverAddr = ipv4Node1->GetAddress (1 + i, 0).GetLocal ();
+      Ipv4Address serverAddr = ipv4Node1->GetAddress (striped ? 1 : 1 + i, 0).GetLocal ();
 
       // Set up the server
       UdpEchoServerHelper echoServer (serverPortBase + i); // Sets up a UDP Echo Server on Node 1 (v2) for each wavelength which listens for incoming packets
       ApplicationContainer serverApp = echoServer.Install (nodes.Get (1));
       serverApp.Start (Seconds (1.0));
-      serverApp.Stop (Seconds (30.0));
+      serverApp.Stop (ScenarioConfig::StopTime ());
 
       // Set up the client
       UdpEchoClientHelper echoClient (serverAddr, serverPortBase + i);
 
       // ---------- DISTINCT TRAFFIC PATTERNS ----------
-      if (i == 0)
-        { // Configures the UDP Echo Client on Node 0 (v1) with distinct traffic patterns for each wavelength.
-          // Wavelength 0 
-          echoClient.SetAttribute ("MaxPackets", UintegerValue (2000));
-          echoClient.SetAttribute ("Interval", TimeValue (Seconds (0.002)));
-          echoClient.SetAttribute ("PacketSize", UintegerValue (1024));
-        }
-      else
-        {
-          // Wavelength 1
-          echoClient.SetAttribute ("MaxPackets", UintegerValue (500));
-          echoClient.SetAttribute ("Interval", TimeValue (Seconds (0.05)));
-          echoClient.SetAttribute ("PacketSize", UintegerValue (512));
-        }
+      // Configures the UDP Echo Client on Node 0 (v1) with the wavelength's traffic profile
+      const TrafficProfile &traffic = wavelengths[i].traffic;
+      echoClient.SetAttribute ("MaxPackets", UintegerValue (traffic.maxPackets));
+      echoClient.SetAttribute ("Interval", TimeValue (traffic.interval));
+      echoClient.SetAttribute ("PacketSize", UintegerValue (traffic.packetSize));
 
       ApplicationContainer clientApp = echoClient.Install (nodes.Get (0));
       // Start each client at a slightly different time
-      clientApp.Start (Seconds (2.0 + i));
-      clientApp.Stop (Seconds (30.0));
+      clientApp.Start (traffic.start);
+      clientApp.Stop (ScenarioConfig::StopTime ());
     }
 
   // ---------- FLOW MONITOR ----------
   //Installs a FlowMonitor to track throughput, delay, and packet loss for all flows
   FlowMonitorHelper flowmonHelper;
+  flowmonHelper.SetMonitorAttribute ("DelayBinWidth", DoubleValue (1e-5)); // 10 us bins, for the p99 delay
   Ptr<FlowMonitor> flowmon = flowmonHelper.InstallAll ();
 
-  // PCAP tracing enabled for all links
-  for (uint32_t i = 0; i < numWavelengths; i++)
+  // PCAP tracing enabled for all links (the shared fiber has no pcap support)
+  for (uint32_t i = 0; i < numWavelengths && !sharedFiber; i++)
     {
       std::ostringstream fname;
       fname << "wdm-optical-asymmetric-wavelength-" << i;
       wdmHelpers[i].EnablePcapAll (fname.str (), false);
     }
 
+  double setupSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - setupStart).count ();
+  NS_LOG_UNCOND ("Configured " << numWavelengths << " wavelengths in " << setupSeconds << " s");
+
   // Run for 30 seconds
-  Simulator::Stop (Seconds (30.0));
+  Simulator::Stop (ScenarioConfig::StopTime ());
+  // Wall-clock time of the run, so errorMode=closed and errorMode=perbit can be compared directly
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now ();
   Simulator::Run ();
+  double wallSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - wallStart).count ();
 
   // Gather FlowMonitor stats
   flowmon->CheckForLostPackets ();
@@ -219,8 +5298,10 @@ main (int argc, char *argv[])
   std::map<FlowId, FlowMonitor::FlowStats> stats = flowmon->GetFlowStats (); // Collects flow statistics after the simulation
 
   NS_LOG_UNCOND ("\n========== Simulation Results ==========\n");
+  std::vector<const Histogram *> delayHistograms; // Every flow, for the pooled p99
   for (auto &flow : stats)
     {
+      delayHistograms.push_back (&flow.second.delayHistogram);
       Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (flow.first);
 
       double timeFirstTx = flow.second.timeFirstTxPacket.GetSeconds ();
@@ -248,9 +5329,46 @@ main (int argc, char *argv[])
       NS_LOG_UNCOND ("  Lost Packets: " << flow.second.lostPackets);
       NS_LOG_UNCOND ("  Throughput:   " << throughput << " Mbps");
       NS_LOG_UNCOND ("  Avg Delay:    " << avgDelay << " s");
+      NS_LOG_UNCOND ("  p99 Delay:    " << HistogramPercentile (flow.second.delayHistogram, 0.99) << " s");
       NS_LOG_UNCOND ("-----------------------------------------");
     }
+  NS_LOG_UNCOND ("All flows (stripe=" << stripe << ") p99 Delay: " << HistogramPercentile (delayHistograms, 0.99) << " s");
 
+  for (uint32_t i = 0; i < numWavelengths; i++)
+    {
+      OpticalErrorModel::Counters counters = errorModels[i]->GetCounters ();
+      NS_LOG_UNCOND ("Wavelength " << i << " error model: " << counters.packetsInspected << " packets inspected, "
+                                   << counters.packetsCorrupted << " corrupted, ~" << counters.bitErrors
+                                   << " bit errors");
+    }
+  if (striped)
+    {
+      for (uint32_t i = 0; i < numWavelengths; i++)
+        {
+          NS_LOG_UNCOND ("Wavelength " << i << " carried " << bonds[0]->GetSlaveTxPackets (i) << " striped packets from node 0");
+        }
+      for (uint32_t n = 0; n < 2 && resequence; n++)
+        {
+          const WdmResequencer::Stats &rs = bonds[n]->GetResequenceStats ();
+          double meanDepth = rs.reordered > 0 ? static_cast<double> (rs.sumDepth) / rs.reordered : 0.0;
+          double meanHoldMs = rs.packets > 0 ? rs.totalHold.GetSeconds () * 1e3 / rs.packets : 0.0;
+          NS_LOG_UNCOND ("Node " << n << " resequencer: " << rs.packets << " packets, " << rs.reordered
+                                 << " reordered (mean depth " << meanDepth << ", max " << rs.maxDepth << "), "
+                                 << rs.late << " late, " << rs.holesSkipped << " holes skipped, added latency mean "
+                                 << meanHoldMs << " ms, max " << rs.maxHold.GetSeconds () * 1e3 << " ms");
+        }
+    }
+  if (isBias > 1.0)
+    { // The simulated drops follow the biased rate; these are the unbiased estimates
+      for (uint32_t i = 0; i < numWavelengths; i++)
+        {
+          OpticalErrorModel::LossEstimate estimate = errorModels[i]->GetLossEstimate ();
+          NS_LOG_UNCOND ("Wavelength " << i << " importance-sampled loss: " << estimate.lossRate << " +/- "
+                                       << estimate.ci95 << " (95% CI, " << estimate.packets << " packets, bias "
+                                       << isBias << ")");
+        }
+    }
+  NS_LOG_UNCOND ("Error model mode: " << errorMode << ", Simulator::Run wall time: " << wallSeconds << " s");
   NS_LOG_UNCOND ("Done.\n");
 
   Simulator::Destroy ();